@@ -4,6 +4,32 @@
 : T->IN      h# 0400 ;
 : [T]->IN    h# 0800 ;
 : R->IN      h# 0c00 ;
+: [T]8       h# 04e3 ;
+: [T]16      h# 04e2 ;
+: [T]32      h# 04e1 ;
+: ext:um*    h# 04d0 ;
+: ext:m*     h# 04d1 ;
+: ext:um/mod h# 04d2 ;
+: ext:sm/rem h# 04d3 ;
+: ext:u/mod  h# 04d4 ;
+: ext:/mod   h# 04d5 ;
+: ext:popcount h# 04d6 ;
+: ext:clz    h# 04d7 ;
+: ext:ctz    h# 04d8 ;
+: ext:min    h# 04d9 ;
+: ext:max    h# 04da ;
+: ext:umin   h# 04db ;
+: ext:umax   h# 04dc ;
+: ext:arshift h# 04dd ;
+: ext:rol    h# 04de ;
+: ext:ror    h# 04df ;
+: ext:bswap  h# 05d0 ;
+: ext:cmove  h# 05d1 ;
+: ext:cmove> h# 05d2 ;
+: ext:move   h# 05d3 ;
+: ext:fill   h# 05d4 ;
+: ext:compare h# 05d5 ;
+: ext:search h# 05d6 ;
 
 \ alu_op
 : IN->       h# 0000 or ;
@@ -104,6 +130,35 @@
 :: over=             T->IN   IN==N     ->T     d+0    r+0       alu     ;
 :: swap>r            N->IN   T->N,IN-> ->R     d-1    r+1       alu     ;
 :: swapr>            R->IN   T<>N,IN-> ->T     d+1    r-1       alu     ;
+:: c@                [T]8              ->T     d+0    r+0       alu     ;
+:: c!                [T]8              ->[T]   d-2    r+0       alu     ;
+:: w@                [T]16             ->T     d+0    r+0       alu     ;
+:: w!                [T]16             ->[T]   d-2    r+0       alu     ;
+:: l@                [T]32             ->T     d+0    r+0       alu     ;
+:: l!                [T]32             ->[T]   d-2    r+0       alu     ;
+:: um*               ext:um*           ->T     d+0    r+0       alu     ;
+:: m*                ext:m*            ->T     d+0    r+0       alu     ;
+:: um/mod            ext:um/mod        ->T     d+0    r+0       alu     ;
+:: sm/rem            ext:sm/rem        ->T     d+0    r+0       alu     ;
+:: u/mod             ext:u/mod         ->T     d+0    r+0       alu     ;
+:: /mod              ext:/mod          ->T     d+0    r+0       alu     ;
+:: popcount          ext:popcount      ->T     d+0    r+0       alu     ;
+:: clz               ext:clz           ->T     d+0    r+0       alu     ;
+:: ctz               ext:ctz           ->T     d+0    r+0       alu     ;
+:: min               ext:min           ->T     d+0    r+0       alu     ;
+:: max               ext:max           ->T     d+0    r+0       alu     ;
+:: umin              ext:umin          ->T     d+0    r+0       alu     ;
+:: umax              ext:umax          ->T     d+0    r+0       alu     ;
+:: arshift           ext:arshift       ->T     d+0    r+0       alu     ;
+:: rol               ext:rol           ->T     d+0    r+0       alu     ;
+:: ror               ext:ror           ->T     d+0    r+0       alu     ;
+:: bswap             ext:bswap         ->T     d+0    r+0       alu     ;
+:: cmove             ext:cmove         ->T     d+0    r+0       alu     ;
+:: cmove>            ext:cmove>        ->T     d+0    r+0       alu     ;
+:: move              ext:move          ->T     d+0    r+0       alu     ;
+:: fill              ext:fill          ->T     d+0    r+0       alu     ;
+:: compare           ext:compare       ->T     d+0    r+0       alu     ;
+:: search-wordlist         ext:search        ->T     d+0    r+0       alu     ;
 :: 1+             1          imm+                               imm     ;
 :: 2+             2          imm+                               imm     ;
 :: 2*             1                                             imm    
@@ -210,75 +265,34 @@
                      N->IN   IN<<T     ->T     d-1    r+0       alu     ;
 :: nmask8       255                                             imm    
                      T->IN   ~IN       ->T     d+0    r+0       alu     ;
-:: w@                [T]->IN IN->      ->T     d+0    r+0       alu    
-                 48                                             imm    
-                     N->IN   IN<<T     ->T     d-1    r+0       alu    
-                 48                                             imm    
-                     N->IN   IN>>T     ->T     d-1    r+0       alu     ;
-:: c@                T->IN   IN->      ->R     d-1    r+1       alu    
-                     R->IN   [IN]      ->T     d+1    r+0       alu    
-                255                                             imm    
-                     T->IN   IN&N      ->T     d-1    r+0       alu    
-                     R->IN   IN->      ->T     d+1    r-1       alu    
-                256                                             imm    
-                     T->IN   IN&N      ->T     d-1    r+0       alu    
-                     T->IN   IN|N      ->T     d-1    r+0       alu     ;
-:: c!                T->IN   IN->      ->R     d-1    r+1       alu    
-                255                                             imm    
-                     T->IN   IN&N      ->T     d-1    r+0       alu    
-                     R->IN   [IN]      ->T     d+1    r+0       alu    
-                255                                             imm    
-                     T->IN   ~IN       ->T     d+0    r+0       alu    
-                     T->IN   IN&N      ->T     d-1    r+0       alu    
-                     T->IN   IN|N      ->T     d-1    r+0       alu    
-                     R->IN   IN->      ->T     d+1    r-1       alu    
-                     N->IN   IN->      ->[T]   d-2    r+0       alu     ;
 :: nmask16        0                                             imm    
                      T->IN   ~IN       ->T     d+0    r+0       alu    
                  16                                             imm    
                      N->IN   IN<<T     ->T     d-1    r+0       alu     ;
-:: w!                T->IN   IN->      ->R     d-1    r+1       alu    
-                 48                                             imm    
-                     N->IN   IN<<T     ->T     d-1    r+0       alu    
-                 48                                             imm    
-                     N->IN   IN>>T     ->T     d-1    r+0       alu    
-                     R->IN   IN->      ->T     d+1    r+0       alu    
-                     [T]->IN IN->      ->T     d+0    r+0       alu    
-                  0                                             imm    
-                     T->IN   ~IN       ->T     d+0    r+0       alu    
-                 16                                             imm    
-                     N->IN   IN<<T     ->T     d-1    r+0       alu    
-                     T->IN   IN&N      ->T     d-1    r+0       alu    
-                     T->IN   IN|N      ->T     d-1    r+0       alu    
-                     R->IN   IN->      ->T     d+1    r-1       alu    
-                     N->IN   IN->      ->[T]   d-2    r+0       alu     ;
 :: 2w@               T->IN   IN->      ->T     d+1    r+0       alu    
-                     [T]->IN IN->      ->T     d+0    r+0       alu    
-                 48                                             imm    
-                     N->IN   IN<<T     ->T     d-1    r+0       alu    
-                 48                                             imm    
-                     N->IN   IN>>T     ->T     d-1    r+0       alu    
+                     [T]16             ->T     d+0    r+0       alu    
                      N->IN   T->N,IN-> ->T     d+0    r+0       alu    
                   2          imm+                               imm    
-                     [T]->IN IN->      ->T     d+0    r+0       alu    
-                 48                                             imm    
-                     N->IN   IN<<T     ->T     d-1    r+0       alu    
-                 48                                             imm    
-                     N->IN   IN>>T     ->T     d-1    r+0       alu     ;
+                     [T]16             ->T     d+0    r+0       alu     ;
 :: 2w!               T->IN   IN->      ->R     d-1    r+1       alu    
                  16                                             imm    
                      N->IN   IN<<T     ->T     d-1    r+0       alu    
                      T->IN   IN|N      ->T     d-1    r+0       alu    
-                     R->IN   IN->      ->T     d+1    r+0       alu    
-                     [T]->IN IN->      ->T     d+0    r+0       alu    
-                  0                                             imm    
-                     T->IN   ~IN       ->T     d+0    r+0       alu    
-                 32                                             imm    
-                     N->IN   IN<<T     ->T     d-1    r+0       alu    
-                     T->IN   IN&N      ->T     d-1    r+0       alu    
-                     T->IN   IN|N      ->T     d-1    r+0       alu    
                      R->IN   IN->      ->T     d+1    r-1       alu    
-                     N->IN   IN->      ->[T]   d-2    r+0       alu     ;
+                     [T]32             ->[T]   d-2    r+0       alu     ;
+:: /                 ext:/mod          ->T     d+0    r+0       alu    
+                     T->IN   T->N,IN-> ->T     d-1    r+0       alu     ;
+:: mod               ext:/mod          ->T     d+0    r+0       alu    
+                     N->IN   IN->      ->T     d-1    r+0       alu     ;
+:: */mod             T->IN   IN->      ->R     d-1    r+1       alu    
+                     ext:m*            ->T     d+0    r+0       alu    
+                     R->IN   IN->      ->T     d+1    r-1       alu    
+                     ext:sm/rem        ->T     d+0    r+0       alu     ;
+:: */                T->IN   IN->      ->R     d-1    r+1       alu    
+                     ext:m*            ->T     d+0    r+0       alu    
+                     R->IN   IN->      ->T     d+1    r-1       alu    
+                     ext:sm/rem        ->T     d+0    r+0       alu    
+                     T->IN   T->N,IN-> ->T     d-1    r+0       alu     ;
 :: .s             0                                             imm    
                 224                                             imm    
                      N->IN   IN->      ->io[T] d-2    r+0       alu     ;
@@ -1,5 +1,10 @@
 $00f1 constant IO-OUT
 $00e0 constant IO-IN
+$00f2 constant IO-TYPE
+$00f3 constant IO-TYPE-ADDR
+$00e1 constant IO-LINE-ADDR
+$00e2 constant IO-LINE
+$00e3 constant IO-TTY
 
 \ meta
 \     $3f80 org 
@@ -59,9 +64,27 @@ header u>       : u>        swap u< ;
     d# 0 swap !
 ;
 
+\ yields to the host: the VM halts on the zero cell, and the host carries
+\ on past it once the input a read was waiting for is ready
+header pause
+: pause
+    [ 0 tcode, ]
+;
+
+\ -2 from a read means it would block; pause and try again
+: io-wait@ ( port -- x )
+    begin
+        dup io@
+        dup d# -2 =
+    while
+        drop pause
+    repeat
+    nip
+;
+
 header key
 : key
-    IO-IN io@
+    IO-IN io-wait@
 ;
 
 header emit
@@ -115,8 +138,10 @@ header +!       : +!    tuck @ + swap ! ;
 header 2swap    : 2swap rot >r rot r> ;
 header 2over    : 2over >r >r 2dup r> r> 2swap ;
 
-header min      : min   2dup< if drop else nip then ;
-header max      : max   2dup< if nip else drop then ;
+header min      :noname     min      ;
+header max      :noname     max      ;
+header umin     :noname     umin     ;
+header umax     :noname     umax     ;
 
 header hi32  : hi32 ( dw -- w ) d# 32 rshift ;
 header lo32  : lo32 ( dw -- w ) d# 32 lshift d# 32 rshift ;
@@ -129,17 +154,7 @@ header uw@
     w@
 ;
 
-header w!
-: w! ( u c-addr -- )
-    dup>r d# 2 and if
-        d# 16 lshift
-        r@ @ lo16
-    else
-        lo16
-        r@ @ hi16
-    then
-    or r> !
-;
+header w!       :noname     w!       ;
 
 : w+!   ( u a -- ) \ like +! but for 16-bit a
     tuck uw@ + swap w!
@@ -155,16 +170,11 @@ header bounds
     over + swap
 ;
 
+\ the VM writes the whole block at once, see io 0xf2
 header type
-: type
-    bounds
-    begin
-        2dupxor
-    while
-        dup c@ emit
-        1+
-    repeat
-    2drop
+: type ( addr u -- )
+    swap IO-TYPE-ADDR io!
+    IO-TYPE io!
 ;
 
 create "cold"
@@ -236,7 +246,7 @@ header negate   : negate    invert 1+ ;
 header -        : -         negate + ; 
 header abs      : abs       dup 0< if negate then ; 
 header 2*       : 2*        d# 1 lshift ; 
-header 2/       : 2/        dup 0< if invert d# 1 rshift invert else d# 1 rshift then ; 
+header 2/       : 2/        d# 1 arshift ;
 header here     : here      dp @ ;
 \ header depth    : depth     depths h# 1f and ;
 
@@ -364,63 +374,17 @@ header d2/
 \     begin again
 \ ;
 
-create scratch 0 ,
-
-: mulstep ( ud u1 -- ud u1 )
-    DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE
-    >r
-    d# 1 lshift over d# 31 rshift + swap d# 1 lshift swap
-    r@ d# 0 < if 
-        scratch @ d# 0 d+ 
-    then 
-    r> d# 1 lshift
-;
-
-header um*
-: um*  ( u1 u2 -- ud ) 
-    scratch ! 
-    d# 0. rot
-    mulstep
-    drop 
-; 
-
-: mul32step ( u2 u1 -- u2 u1 )
-    DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE
-    >r
-    d# 1 lshift
-    r@ d# 0 < if 
-        scratch @ +
-    then 
-    r> d# 1 lshift
-;
-
-header *
-: *
-    scratch !
-    d# 0 swap
-    mul32step
-    drop
-;
-
-\ see Hacker's Delight (2nd ed) 9-4 "Unsigned Long Division"
-
-: divstep  \ ( y x z )
-    DOUBLE DOUBLE DOUBLE DOUBLE DOUBLE
-    >r
-    dup 0< >r
-    2dup d+
-    dup r> or r@ u< invert if
-        r@ -
-        swap 1+ swap
-    then
-    r>
-;
-
-header um/mod
-: um/mod \ ( ud u1 -- u2 u3 ) ( 6.1.2370 ) 
-    divstep
-    drop swap 
-; 
+header *        :noname     *        ;
+header um*      :noname     um*      ;
+header m*       :noname     m*       ;
+header um/mod   :noname     um/mod   ;
+header sm/rem   :noname     sm/rem   ;
+header u/mod    :noname     u/mod    ;
+header /mod     :noname     /mod     ;
+header /        :noname     /        ;
+header mod      :noname     mod      ;
+header */mod    :noname     */mod    ;
+header */       :noname     */       ;
 
 \ Unicode-friendly ACCEPT contibuted by Matthias Koch
 
@@ -464,42 +428,12 @@ header accept
     space
 ;
 
-: 3rd   >r over r> swap ;
-: 3dup  3rd 3rd 3rd ;
-
 : lower ( c1 -- c2 ) \ c2 is the lower-case of c1
     h# 40 over <
     over h# 5b < and
     h# 20 and +
 ;
 
-: i<> ( c1 c2 -- f ) \ case-insensitive difference
-    2dupxor h# 1f and if
-        drop exit
-    then
-    lower swap lower xor
-;
-
-: sameword ( c-addr u wp -- c-addr u wp flag )
-    2dup d# 2 + c@ = if
-        3dup
-        d# 3 + >r
-        bounds
-        begin
-            2dupxor
-        while
-            dup c@ r@ c@ i<> if
-                2drop rdrop false exit
-            then
-            1+
-            r> 1+ >r
-        repeat
-        2drop rdrop true
-    else
-        false
-    then
-;
-
 header caligned
 : caligned
     1+ d# -2 and
@@ -519,27 +453,16 @@ header calign
     dp !
 ;
 
-\ lsb 0 means non-immediate, return -1
-\     1 means immediate,     return  1
-: isimmediate ( wp -- -1 | 1 )
-    uw@ d# 1 and 2* 1-
-;
+\ search-wordlist looks names up in a hashed index the VM keeps over the
+\ header chain, ignoring case; the newest definition of a name wins.
+header search-wordlist :noname search-wordlist ;
 
 header sfind
-: sfind
-    forth uw@
-    begin
-        dup
-    while
-        sameword
-        if 
-            nip nip
-            dup >xt
-            swap isimmediate
-            exit
-        then
-        nextword
-    repeat
+: sfind ( c-addr u -- c-addr u 0 | xt 1 | xt -1 )
+    2dup forth search-wordlist
+    dup if
+        2swap 2drop
+    then
 ;
 
 : digit? ( c -- u f )
@@ -567,42 +490,11 @@ header >number
     repeat
 ;
 
-header fill
-: fill ( c-addr u char -- ) ( 6.1.1540 ) 
-  >r  bounds 
-  begin
-    2dupxor 
-  while
-    r@ over c! 1+ 
-  repeat
-  r> drop 2drop
-; 
-
-header cmove
-: cmove ( addr1 addr2 u -- )
-    bounds rot >r
-    begin
-        2dupxor
-    while
-        r@ c@ over c!
-        r> 1+ >r
-        1+
-    repeat
-    rdrop 2drop
-;
-
-header cmove>
-: cmove> \ ( addr1 addr2 u -- )
-    begin
-        dup
-    while
-        1- >r
-        over r@ + c@
-        over r@ + c!
-        r>
-    repeat
-    drop 2drop
-;
+header fill     :noname     fill     ;
+header cmove    :noname     cmove    ;
+header cmove>   :noname     cmove>   ;
+header move     :noname     move     ;
+header compare  :noname     compare  ;
 
 header execute
 : execute
@@ -1040,9 +932,21 @@ header drop     :noname     drop     ;
 header over     :noname     over    ;
 header nip      :noname     nip      ;
 header @        :noname     @        ;
+header c@       :noname     c@       ;
+header c!       :noname     c!       ;
+header w@       :noname     w@       ;
+header l@       :noname     l@       ;
+header l!       :noname     l!       ;
 header io!      :noname     io!      ;
 header io@      :noname     io@      ;
 header rshift   :noname     rshift   ;
+header arshift  :noname     arshift  ;
+header rol      :noname     rol      ;
+header ror      :noname     ror      ;
+header popcount :noname     popcount ;
+header clz      :noname     clz      ;
+header ctz      :noname     ctz      ;
+header bswap    :noname     bswap    ;
 header lshift   :noname     lshift   ;
 header-imm >r   :noname     inline: >r ;
 header-imm r>   :noname     inline: r> ;
@@ -1191,11 +1095,22 @@ header-imm postpone
     2drop
 ;
 
+\ reads a whole line in one go, without echo; -1 at the end of input
+: getline ( addr maxlen -- len | -1 )
+    IO-LINE io!
+    IO-LINE-ADDR io!
+    IO-LINE io-wait@
+;
+
 header refill
 : refill
     source-id 0= dup
     if
-        tib dup d# 128 accept
+        tib dup d# 128
+        IO-TTY io@ if accept else getline then
+        dup 0< if
+            2drop 0= exit
+        then
         source!
         d# 0 >in !
     then
@@ -1211,10 +1126,16 @@ header evaluate
     r> >in ! r> r> source!
 ;
 
+\ halts the VM on the zero cell
+header bye
+: bye
+    [ 0 tcode, ]
+;
+
 header quit
 : quit
     begin
-        refill drop
+        refill 0= if bye then
         interpret
         space
         [char] o emit
@@ -56,7 +56,9 @@ void load_hex(const char* filepath, const char* lstpath, context *ctx) {
         // Dereference code pointer, get the address of where our code is.
         uint16_t code_addr=ctx->memory[code_ptr] / 2;
         // Tag the code address with our word's string
-        asprintf(&ctx->meta[code_addr], "%s", word);
+        if (code_addr < VM_META_CELLS && vm_meta(ctx)) {
+            asprintf(&ctx->meta[code_addr], "%s", word);
+        }
         WORDCT++;
         dprintf("  0x%0.4x @ %s => 0x%0.4x\n", target, word, code_addr);
         next_ptr = ctx->memory[next_ptr] / 2;
@@ -125,17 +127,64 @@ void load_hex(const char* filepath, const char* lstpath, context *ctx) {
 }
 
 int main(int argc, char *argv[]) {
-    context *ctx = calloc(sizeof(context), 1);
+    context *ctx = vm_new();
     ctx->words = FORTH_WORDS;
-#ifdef DEBUG
     init_opcodes(ctx->words);
-#endif
-    load_hex(argv[1], NULL, ctx);
+    // Binary images from hex2img load without parsing.
+    const char* suffix = strrchr(argv[1], '.');
+    if (suffix && strcmp(suffix, ".img") == 0) {
+        if (!vm_image_load(ctx, argv[1])) {
+            fprintf(stderr, "Can't load image '%s'\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        load_hex(argv[1], NULL, ctx);
+    }
     ctx->OUT=stdout;
     ctx->IN=stdin;
+    // HEXAFORTH_MEMORY=<bytes> maps that much memory for data above the
+    // code; HEXAFORTH_HUGEPAGES=1 backs it with huge pages.
+    char* memory = getenv("HEXAFORTH_MEMORY");
+    if (memory && !vm_memory(ctx, strtoull(memory, NULL, 0),
+                             getenv("HEXAFORTH_HUGEPAGES") ? VM_MEMORY_HUGE : 0)) {
+        fprintf(stderr, "Can't map HEXAFORTH_MEMORY=%s\n", memory);
+        exit(EXIT_FAILURE);
+    }
+    // HEXAFORTH_ENGINE=switch|threaded picks the execution loop.
+    char* engine = getenv("HEXAFORTH_ENGINE");
+    if (engine) {
+        int selected = vm_engine_lookup(engine);
+        if (selected < 0) {
+            fprintf(stderr, "Unknown HEXAFORTH_ENGINE '%s'\n", engine);
+            exit(EXIT_FAILURE);
+        }
+        ctx->engine = selected;
+    }
+    if (ctx->engine == ENGINE_PREDECODED || ctx->engine == ENGINE_FUSED) {
+        vm_predecode(ctx);
+    }
+    // HEXAFORTH_TRACE=1 traces every instruction to stderr.
+    if (getenv("HEXAFORTH_TRACE")) {
+        vm_trace(ctx, stderr);
+    }
+    // HEXAFORTH_TRACE_RING=<file> records the last million instructions
+    // there instead; render it with hexaforth-trace.
+    char* ring = getenv("HEXAFORTH_TRACE_RING");
+    if (ring && !vm_trace_ring_open(ctx, ring, 1 << 20)) {
+        fprintf(stderr, "Can't open trace ring '%s'\n", ring);
+        exit(EXIT_FAILURE);
+    }
     // ctx->EIP=0x462C / 2;
-    vm(ctx);
+    int status = vm(ctx);
+    if (status == VM_STACK_OVERFLOW || status == VM_STACK_UNDERFLOW) {
+        fprintf(stderr, "\nStack %s\n",
+                status == VM_STACK_OVERFLOW ? "overflow" : "underflow");
+    }
     printf("\n[%lld instructions executed]\n", ctx->CYCLES);
+    vm_trace_ring_close(ctx);
+#ifdef VM_PROFILE
+    vm_profile_report(ctx, stderr, 20);
+#endif // VM_PROFILE
 
     // context *ctx = malloc(sizeof(context));
     // ctx->HERE = 0;
@@ -0,0 +1,125 @@
+//
+// bench.c - times each execution engine on a few small kernels.
+//
+// Usage: hexaforth_bench [iterations]
+//
+// Built with VM_STATS, it also reports data stack loads and stores per
+// iteration for the engines that count them.
+//
+
+#include "../vm.h"
+#include "../vm_opcodes.h"
+#include "compiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  const char *label;
+  // Forth words executed once per iteration, before the loop test.
+  const char *body;
+  // Whether `body` runs through a call/exit pair.
+  bool call;
+} bench_kernel;
+
+static const bench_kernel KERNELS[] = {
+    {"alu", "dup 3 + 5 xor 7 and drop", false},
+    {"stack", "dup over swap drop nip dup drop", false},
+    {"memory", "dup 4000 ! 4000 @ drop", false},
+    {"call", "dup 1 + drop", true},
+    {"rot", "dup dup rot drop drop", false},
+    {"2swap", "dup dup dup 2swap drop drop drop", false},
+    {"2over", "dup dup dup 2over 2drop 2drop drop", false},
+    {NULL, NULL, false},
+};
+
+// Lay out:
+//
+//   iterations
+//   loop: <body> 1- dup 0branch done jmp loop
+//   done: drop halt
+//
+// with <body> moved into a subroutine at the end of the image when the
+// kernel is call-heavy.
+static bool build_kernel(context *ctx, const bench_kernel *kernel,
+                         int64_t iterations) {
+  insert_literal(ctx, iterations);
+  uint16_t loop = ctx->HERE;
+  uint16_t call_site = 0;
+  if (kernel->call) {
+    call_site = ctx->HERE;
+    insert_jump(ctx, OP_TYPE_CALL, 0);
+  } else if (!compile_words(ctx, kernel->body)) {
+    return (false);
+  }
+  if (!compile_words(ctx, "1- dup")) {
+    return (false);
+  }
+  uint16_t branch = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CJMP, 0);
+  insert_jump(ctx, OP_TYPE_JMP, loop);
+  uint16_t done = ctx->HERE;
+  if (!compile_words(ctx, "drop")) {
+    return (false);
+  }
+  insert_uint16(ctx, 0);
+  ((instruction *)&ctx->memory[branch])->jmp.target = done;
+  if (kernel->call) {
+    ((instruction *)&ctx->memory[call_site])->jmp.target = ctx->HERE;
+    if (!compile_words(ctx, kernel->body) || !compile_words(ctx, "exit")) {
+      return (false);
+    }
+  }
+  return (true);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+  int64_t iterations = argc > 1 ? strtoll(argv[1], NULL, 10) : 10000000;
+  init_opcodes(FORTH_WORDS);
+
+  printf("%-8s %-12s %14s %10s %10s", "kernel", "engine", "instructions",
+         "seconds", "MIPS");
+#ifdef VM_STATS
+  printf(" %8s %9s", "loads/it", "stores/it");
+#endif // VM_STATS
+  printf("\n");
+  for (const bench_kernel *kernel = KERNELS; kernel->label; kernel++) {
+    for (int engine = 0; engine < VM_ENGINE_COUNT; engine++) {
+      context *ctx = vm_new();
+      ctx->words = FORTH_WORDS;
+      ctx->OUT = stdout;
+      ctx->IN = stdin;
+      ctx->engine = engine;
+      if (!build_kernel(ctx, kernel, iterations)) {
+        printf("%s: failed to compile \"%s\"\n", kernel->label, kernel->body);
+        return (1);
+      }
+      double start = now();
+      vm(ctx);
+      double elapsed = now() - start;
+      printf("%-8s %-12s %14llu %10.3f %10.1f", kernel->label,
+             VM_ENGINE_REPR[engine], (unsigned long long)ctx->CYCLES, elapsed,
+             ctx->CYCLES / elapsed / 1e6);
+#ifdef VM_STATS
+      if (engine == ENGINE_SWITCH || engine == ENGINE_STACKCACHE) {
+        printf(" %8.2f %9.2f",
+               (double)ctx->stats.dstack_loads / iterations,
+               (double)ctx->stats.dstack_stores / iterations);
+      } else {
+        printf(" %8s %9s", "-", "-");
+      }
+#endif // VM_STATS
+      printf("\n");
+      vm_release(ctx);
+      free(ctx);
+    }
+  }
+  return (0);
+}
@@ -21,6 +21,15 @@ void insert_opcode(context *ctx, instruction op) {
   ctx->HERE++;
 }
 
+// Write a jump, conditional jump or call of `op_type` to `target`; a
+// forward one can be written with target 0 and patched once it's known.
+void insert_jump(context *ctx, uint16_t op_type, uint16_t target) {
+  instruction ins = {};
+  ins.jmp.op_type = op_type;
+  ins.jmp.target = target;
+  insert_opcode(ctx, ins);
+}
+
 // This function is used by `compile_word` to determine when it's reached
 // the end of an instruction stream that it needs to write out.
 bool is_null_instruction(instruction ins) {
@@ -275,7 +284,7 @@ bool compile(context *ctx, const char *input) {
   bool string = false;
 
   // Loop through the characters in our buffer.
-  for (int i = 0; i <= input_len; i++) {
+  for (int i = 0; i < input_len; i++) {
     if (input[i] == '\'' && string) {
       buffer[i] = '\0';
       if (strlen(word)) {
@@ -316,3 +325,16 @@ bool compile(context *ctx, const char *input) {
   free(buffer);
   return (true);
 }
+
+// Like `compile()`, without the trailing halt, for laying out code around
+// jumps inserted in between.
+bool compile_words(context *ctx, const char *words) {
+  char *input = strdup(words);
+  bool ok = true;
+  for (char *word = strtok(input, " "); ok && word;
+       word = strtok(NULL, " ")) {
+    ok = compile_word(ctx, word);
+  }
+  free(input);
+  return (ok);
+}
@@ -11,7 +11,9 @@
 
 bool is_null_instruction(instruction ins);
 void insert_opcode(context *ctx, instruction op);
+void insert_jump(context *ctx, uint16_t op_type, uint16_t target);
 bool compile(context *ctx, const char *input);
+bool compile_words(context *ctx, const char *words);
 bool compile_word(context *ctx, const char *word);
 void insert_literal(context *ctx, int64_t n);
 void insert_uint16(context *ctx, uint16_t n);
@@ -254,6 +254,7 @@ int main() {
 
     // Compile with C compiler
     context c_ctx = {0};
+    vm_memory(&c_ctx, VM_MEMORY_BYTES, 0);
     c_ctx.words = calloc(1024, sizeof(word_node));
 
     // Suppress opcode output during comparison
@@ -335,6 +336,7 @@ int main() {
     }
 
     free(c_ctx.words);
+    vm_release(&c_ctx);
   }
 
   // Summary of compiler comparison
@@ -355,12 +357,25 @@ int main() {
     free(cross_tests[i].bytes);
   }
 
-  // Now run the VM execution tests
-  printf("\nRunning VM execution tests:\n");
-  printf("===========================\n");
-
-  if (ret) {
-    ret = execute_tests(&ctx, TESTS);
+  // Now run the VM execution tests, once per engine.
+  for (int engine = 0; ret && engine < VM_ENGINE_COUNT; engine++) {
+    printf("\nRunning VM execution tests (%s engine):\n",
+           VM_ENGINE_REPR[engine]);
+    printf("===========================\n");
+    ctx.engine = engine;
+    ret = execute_tests(&ctx, TESTS) && execute_budget_tests(&ctx) &&
+        execute_trace_tests(&ctx) && execute_snapshot_tests(&ctx) &&
+        execute_stack_tests(&ctx) && execute_memory_tests(&ctx) &&
+        execute_io_tests(&ctx) && execute_blocking_tests(&ctx) &&
+        execute_image_tests(&ctx);
+#ifdef HEXAFORTH_SERVER
+    ret = ret && execute_server_tests(&ctx);
+#endif // HEXAFORTH_SERVER
   }
+#ifdef HEX2C
+  // The translator is engine independent; check it once, against the
+  // switch engine.
+  ret = ret && execute_aot_tests(&ctx);
+#endif // HEX2C
   return (!ret);
 }
@@ -237,6 +237,21 @@ static hexaforth_test TESTS[] = {
      .input = "key emit key emit key emit key emit",
      .io_input = "dead",
      .io_expected = "dead"},
+    // io 0xf3 latches the address and io 0xf2 writes that many bytes; the
+    // harness compares output against `io_input`.
+    {.label = "type ( addr u -- )",
+     .init = "7378415037781730660",
+     .input = "4 243 io! 4 242 io! 0 243 io! 4 242 io! 1 243 io! 0 242 io!",
+     .io_input = "beefdead",
+     .io_expected = "beefdead"},
+    // io 0xe1 and 0xe2 set the line buffer and io 0xe2 reads a line into it,
+    // giving -1 at the end of input; the line is typed back.
+    {.label = "getline ( addr maxlen -- len | -1 )",
+     .input = "8 225 io! 16 226 io! 226 io@ 8 243 io! dup 242 io! "
+              "10 241 io! 226 io@",
+     .io_input = "hello\n",
+     .io_expected = "hello\n",
+     .dstack = "5 -1"},
     {.label = "+! ( n addr -- )",
      .init = "8",
      .input = "0 >r "
@@ -353,6 +368,98 @@ static hexaforth_test TESTS[] = {
      .init = "0 0 0 0",
      .input = "43981 61680 0 2w! 0 @",
      .dstack = "4042304461"},  // 0xF0F0ABCD as decimal
+    {.label = "l@ ( addr -- l )",
+     .init = "-1 0 0 0",
+     .input = "0 l@ 4 l@ 6 l@",
+     .dstack = "4294967295 4294967295 65535"},
+    {.label = "l! preserves other bytes",
+     .init = "72623859790382856 0 0 0",  // 0x0102030405060708
+     .input = "305419896 2 l! 0 @",  // Write 0x12345678 to byte 2
+     .dstack = "72640559989655304"},  // 0x0102123456780708
+    {.label = "c! c@ keep the rest of the stack",
+     .init = "0 0 0 0",
+     .input = "7 8 'a' 3 c! 3 c@",
+     .dstack = "7 8 97"},
+    {.label = "um* ( u1 u2 -- ud )",
+     .input = "-1 -1 um* 3 5 um*",
+     .dstack = "1 -2 15 0"},
+    {.label = "m* ( n1 n2 -- d )",
+     .input = "-3 5 m* -1 -1 m*",
+     .dstack = "-15 -1 1 0"},
+    {.label = "um/mod ( ud u -- rem quot )",
+     .input = "1 -2 -1 um/mod 17 0 5 um/mod",
+     .dstack = "0 -1 2 3"},
+    {.label = "sm/rem ( d n -- rem quot )",
+     .input = "-7 -1 2 sm/rem 7 0 -2 sm/rem",
+     .dstack = "-1 -3 1 -3"},
+    {.label = "u/mod ( u1 u2 -- rem quot )",
+     .input = "-1 10 u/mod",
+     .dstack = "5 1844674407370955161"},
+    {.label = "/mod / mod ( n1 n2 -- ... )",
+     .input = "-7 2 /mod -7 2 / -7 2 mod",
+     .dstack = "-1 -3 -3 -1"},
+    {.label = "/mod by zero and overflow",
+     .input = "7 0 /mod -9223372036854775808 -1 /mod",
+     .dstack = "7 -1 0 -9223372036854775808"},
+    {.label = "*/ ( n1 n2 n3 -- n1*n2/n3 )",
+     .input = "4611686018427387904 6 4 */ 100 -3 7 */mod",
+     .dstack = "6917529027641081856 -6 -42"},
+    {.label = "popcount clz ctz ( u -- n )",
+     .input = "-1 popcount 4096 clz 4096 ctz 0 clz 0 ctz",
+     .dstack = "64 51 12 64 64"},
+    {.label = "min max umin umax ( a b -- c )",
+     .input = "-5 3 min -5 3 max -5 3 umin -5 3 umax",
+     .dstack = "-5 3 3 -5"},
+    {.label = "arshift ( n u -- n>>u )",
+     .input = "-1024 4 arshift 1024 4 arshift -1 100 arshift",
+     .dstack = "-64 64 -1"},
+    {.label = "rol ror ( u1 u -- u2 )",
+     .input = "-9223372036854775808 1 rol 1 1 ror 255 64 rol",
+     .dstack = "1 -9223372036854775808 255"},
+    {.label = "bswap ( u1 -- u2 )",
+     .input = "255 bswap 72623859790382856 bswap",
+     .dstack = "-72057594037927936 578437695752307201"},
+    {.label = "cmove ( from to u -- )",
+     .init = "72623859790382856 0 0 0",  // 0x0102030405060708
+     .input = "0 8 8 cmove 8 @ 0 1 5 cmove 0 @",
+     .dstack = "72623859790382856 72629374578853896"},  // 0x0102080808080808
+    {.label = "cmove> ( from to u -- )",
+     .init = "72623859790382856 0 0 0",
+     .input = "1 0 5 cmove> 0 @",
+     .dstack = "72623855461663491"},  // 0x0102030303030303
+    {.label = "move ( from to u -- )",
+     .init = "72623859790382856 0 0 0",
+     .input = "0 1 5 move 0 @",
+     .dstack = "72624963613820936"},  // 0x0102040506070808
+    {.label = "fill ( addr u c -- )",
+     .init = "0 0 0 0",
+     .input = "1 6 171 fill 0 @ 8 @ 0 -1 7 fill 0 @",
+     .dstack = "48320974825433856 0 48320974825433856"},  // 0x00ABABABABABAB00
+    {.label = "compare ( a1 u1 a2 u2 -- n )",
+     .init = "7378415037781730660 7378415037781730660 0 0",
+     .input = "0 8 8 8 compare 0 7 8 8 compare 0 8 8 7 compare "
+              "0 1 1 1 compare 1 1 0 1 compare",
+     .dstack = "0 -1 1 -1 1"},
+    // Headers "dup" at 8, immediate "IF" at 16 and "DUP" at 24, newest in
+    // the cell at 0; names to look up at 40.
+    {.label = "search-wordlist ( c-addr u wid -- 0 | xt 1 | xt -1 )",
+     .init = "24 76966318133411840 153685639156596745 230616333069516816 0 "
+             "8825217326060172644",
+     .input = "40 3 0 search-wordlist 43 2 0 search-wordlist "
+              "45 3 0 search-wordlist",
+     .dstack = "819 -1 546 1 0"},
+    {.label = "search-wordlist ( wordlist rewound and regrown )",
+     .init = "24 76966318133411840 153685639156596745 230616333069516816 0 "
+             "8825217326060172644",
+     .input = "40 3 0 search-wordlist 2drop 8 0 w! 40 3 0 search-wordlist "
+              "43 2 0 search-wordlist 24 0 w! 40 3 0 search-wordlist",
+     .dstack = "273 -1 0 819 -1"},
+    {.label = "search-wordlist ( after fill over an indexed header )",
+     .init = "24 76966318133411840 153685639156596745 230616333069516816 0 "
+             "8825217326060172644",
+     .input = "40 3 0 search-wordlist 2drop 27 3 120 fill "
+              "40 3 0 search-wordlist",
+     .dstack = "273 -1"},
     // Test array terminator
     {.label = "", .input = "", .dstack = ""},
     // {.label = "c@ ( addr -- c )",
@@ -5,8 +5,18 @@
 #include "vm_test.h"
 #include "../util/stack.h"
 #include "../vm_debug.h"
+#include "../vm_image.h"
+#include "../vm_trace_ring.h"
 #include "compiler.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 bool decode_literal(const char *begin, const char *end, int64_t *num) {
   char *decode_end;
@@ -174,11 +184,12 @@ bool execute_test(context *in_ctx, hexaforth_test test) {
 
   bool io_match;
 
-  // We use calloc rather than malloc, as malloc will often return memory of a
+  // vm_new() zeroes the context, as malloc will often return memory of a
   // previously free'd but non-zero'ed context.
-  context *ctx = calloc(1, sizeof(context));
+  context *ctx = vm_new();
   if (in_ctx) {
     ctx->words = in_ctx->words;
+    ctx->engine = in_ctx->engine;
   } else {
     init_opcodes(ctx->words);
   }
@@ -252,6 +263,7 @@ bool execute_test(context *in_ctx, hexaforth_test test) {
     printf("TEST: Failed to compile: \"%s\"\n", test.input);
   };
   free(output);
+  vm_release(ctx);
   free(ctx);
   free(expected_dstack->elems);
   free(expected_dstack);
@@ -277,3 +289,1069 @@ bool execute_tests(context *ctx, hexaforth_test *tests) {
   }
   return (true);
 }
+
+// A fresh context for the budget tests, on the same engine as `in_ctx`.
+static context *budget_context(context *in_ctx) {
+  context *ctx = vm_new();
+  ctx->words = in_ctx->words;
+  ctx->engine = in_ctx->engine;
+  ctx->IN = stdin;
+  ctx->OUT = stdout;
+  return (ctx);
+}
+
+// Lay out a countdown loop that calls a subroutine each time round:
+//
+//   iterations
+//   loop: call sub 1- dup 0branch done jmp loop
+//   done: drop 7 halt
+//   sub:  dup drop exit
+static bool budget_countdown(context *ctx, int64_t iterations) {
+  insert_literal(ctx, iterations);
+  uint16_t loop = ctx->HERE;
+  uint16_t call_site = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CALL, 0);
+  if (!compile_words(ctx, "1- dup")) {
+    return (false);
+  }
+  uint16_t branch = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CJMP, 0);
+  insert_jump(ctx, OP_TYPE_JMP, loop);
+  ((instruction *)&ctx->memory[branch])->jmp.target = ctx->HERE;
+  if (!compile_words(ctx, "drop 7")) {
+    return (false);
+  }
+  insert_uint16(ctx, 0);
+  ((instruction *)&ctx->memory[call_site])->jmp.target = ctx->HERE;
+  return (compile_words(ctx, "dup drop exit"));
+}
+
+// `vm_run()` in small slices must end exactly where one `vm()` call does,
+// and a runaway loop must come back once its budget is spent.
+bool execute_budget_tests(context *in_ctx) {
+  bool passed = true;
+
+  context *ref = budget_context(in_ctx);
+  context *ctx = budget_context(in_ctx);
+  int slices = 0;
+  if (!budget_countdown(ref, 100) || !budget_countdown(ctx, 100)) {
+    printf("TEST: Failed to compile budget countdown\n");
+    return (false);
+  }
+  vm(ref);
+  while (vm_run(ctx, 5) == VM_PREEMPTED) {
+    slices++;
+  }
+  printf("TEST: %-28s SLICES=%-4d EXPECTED={stack: [%lld] cycles: %llu} => ",
+         "vm_run countdown", slices, ref->DSTACK[ref->SP - 1], ref->CYCLES);
+  if (ctx->SP == ref->SP && ctx->RSP == ref->RSP &&
+      ctx->DSTACK[ctx->SP - 1] == ref->DSTACK[ref->SP - 1] &&
+      ctx->CYCLES == ref->CYCLES && slices > 10) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: SP=%d RSP=%d T=%lld cycles=%llu\n", ctx->SP, ctx->RSP,
+           ctx->DSTACK[ctx->SP - 1], ctx->CYCLES);
+    passed = false;
+  }
+  vm_release(ref);
+  free(ref);
+  vm_release(ctx);
+  free(ctx);
+
+  // noop begin again; a jump to 0 would encode as a zero word.
+  ctx = budget_context(in_ctx);
+  if (!compile_words(ctx, "noop")) {
+    return (false);
+  }
+  insert_jump(ctx, OP_TYPE_JMP, 1);
+  int first = vm_run(ctx, 1000);
+  uint64_t first_cycles = ctx->CYCLES;
+  int second = vm_run(ctx, 1000);
+  printf("TEST: %-28s EXPECTED={preempted twice, cycles: 1000 2000} => ",
+         "vm_run runaway loop");
+  if (first == VM_PREEMPTED && second == VM_PREEMPTED &&
+      first_cycles >= 1000 && first_cycles < 1100 &&
+      ctx->CYCLES >= 2000 && ctx->CYCLES < 2200 && ctx->EIP == 1) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d %d cycles=%llu %llu EIP=%d\n", first, second,
+           first_cycles, ctx->CYCLES, ctx->EIP);
+    passed = false;
+  }
+  vm_release(ctx);
+  free(ctx);
+
+  // Stepping one cycle at a time, or with no budget at all, must still get
+  // through every `exit` rather than stop in front of it each time.
+  for (uint64_t step = 0; step <= 1; step++) {
+    ref = budget_context(in_ctx);
+    ctx = budget_context(in_ctx);
+    if (!budget_countdown(ref, 20) || !budget_countdown(ctx, 20)) {
+      return (false);
+    }
+    vm(ref);
+    slices = 0;
+    while (vm_run(ctx, step) == VM_PREEMPTED && slices <= ref->CYCLES) {
+      slices++;
+    }
+    printf("TEST: vm_run(ctx, %llu) stepping  SLICES=%-4d EXPECTED={stack: "
+           "[%lld] cycles: %llu} => ", step, slices,
+           ref->DSTACK[ref->SP - 1], ref->CYCLES);
+    if (ctx->SP == ref->SP && ctx->RSP == ref->RSP &&
+        ctx->DSTACK[ctx->SP - 1] == ref->DSTACK[ref->SP - 1] &&
+        ctx->CYCLES == ref->CYCLES && slices <= ref->CYCLES) {
+      printf("PASSED\n");
+    } else {
+      printf("FAILED: SP=%d RSP=%d T=%lld cycles=%llu\n", ctx->SP, ctx->RSP,
+             ctx->DSTACK[ctx->SP - 1], ctx->CYCLES);
+      passed = false;
+    }
+    vm_release(ref);
+    free(ref);
+    vm_release(ctx);
+    free(ctx);
+  }
+  return (passed);
+}
+
+static uint64_t count_lines(FILE *file) {
+  uint64_t lines = 0;
+  int c;
+  rewind(file);
+  while ((c = fgetc(file)) != EOF) {
+    lines += c == '\n';
+  }
+  return (lines);
+}
+
+// Tracing switched on and off between `vm_run()` slices must print one
+// line per instruction run while it is on, plus one for the state the
+// slice stops in, and must not change where the run ends.
+bool execute_trace_tests(context *in_ctx) {
+  bool passed = true;
+  context *ref = budget_context(in_ctx);
+  context *ctx = budget_context(in_ctx);
+  FILE *trace = tmpfile();
+  if (!trace || !budget_countdown(ref, 20) || !budget_countdown(ctx, 20)) {
+    printf("TEST: Failed to set up trace countdown\n");
+    return (false);
+  }
+  vm(ref);
+  vm_run(ctx, 50);
+  uint64_t traced_from = ctx->CYCLES;
+  vm_trace(ctx, trace);
+  vm_run(ctx, 50);
+  uint64_t traced_to = ctx->CYCLES;
+  vm_trace(ctx, NULL);
+  while (vm_run(ctx, 50) == VM_PREEMPTED)
+    ;
+  uint64_t lines = count_lines(trace);
+  printf("TEST: %-28s EXPECTED={lines: %llu cycles: %llu} => ",
+         "vm_trace mid-run", traced_to - traced_from + 1, ref->CYCLES);
+  if (lines == traced_to - traced_from + 1 && traced_to > traced_from &&
+      ctx->SP == ref->SP && ctx->RSP == ref->RSP &&
+      ctx->DSTACK[ctx->SP - 1] == ref->DSTACK[ref->SP - 1] &&
+      ctx->CYCLES == ref->CYCLES) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: lines=%llu SP=%d T=%lld cycles=%llu\n", lines, ctx->SP,
+           ctx->DSTACK[ctx->SP - 1], ctx->CYCLES);
+    passed = false;
+  }
+  fclose(trace);
+  vm_release(ctx);
+  free(ctx);
+
+  // A ring smaller than the run keeps the newest instructions, in order.
+  ctx = budget_context(in_ctx);
+  char path[] = "/tmp/hexaforth_ring_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0 || !budget_countdown(ctx, 20) ||
+      !vm_trace_ring_open(ctx, path, 50)) {
+    printf("TEST: Failed to set up trace ring\n");
+    return (false);
+  }
+  close(fd);
+  vm(ctx);
+  struct vm_trace_ring *ring = ctx->ring;
+  bool ordered = ring->header->capacity == 64 &&
+                 ring->header->written == ctx->CYCLES;
+  for (uint64_t idx = ctx->CYCLES - 64; ordered && idx < ctx->CYCLES;
+       idx++) {
+    trace_record *record = &ring->records[idx & ring->mask];
+    ordered = record->cycle == idx &&
+              record->raw == ctx->memory[record->EIP] && record->raw;
+  }
+  printf("TEST: %-28s EXPECTED={records: %llu cycles: %llu} => ",
+         "vm_trace_ring wrap", ctx->CYCLES, ref->CYCLES);
+  if (ordered && ctx->CYCLES == ref->CYCLES &&
+      ctx->DSTACK[ctx->SP - 1] == ref->DSTACK[ref->SP - 1]) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: records=%llu cycles=%llu\n",
+           (unsigned long long)ring->header->written, ctx->CYCLES);
+    passed = false;
+  }
+  unlink(path);
+  vm_release(ref);
+  free(ref);
+  vm_release(ctx);
+  free(ctx);
+  return (passed);
+}
+
+// Clones of a snapshot taken mid-run must each finish like the original
+// would, without seeing each other's writes.
+bool execute_snapshot_tests(context *in_ctx) {
+  bool passed = true;
+  context *ref = budget_context(in_ctx);
+  context *ctx = budget_context(in_ctx);
+  if (!budget_countdown(ref, 20) || !budget_countdown(ctx, 20)) {
+    printf("TEST: Failed to compile snapshot countdown\n");
+    return (false);
+  }
+  vm(ref);
+  vm_run(ctx, 50);
+  uint64_t taken_at = ctx->CYCLES;
+  struct vm_snapshot *snap = vm_snapshot(ctx);
+  context *first = snap ? vm_clone(snap) : NULL;
+  context *second = snap ? vm_clone(snap) : NULL;
+  if (!first || !second) {
+    printf("TEST: Failed to clone snapshot\n");
+    return (false);
+  }
+  vm_snapshot_release(snap);
+  while (vm_run(first, 50) == VM_PREEMPTED)
+    ;
+  first->memory[4000] = 1;
+  printf("TEST: %-28s EXPECTED={stack: [%lld] cycles: %llu} => ",
+         "vm_clone countdown", ref->DSTACK[ref->SP - 1], ref->CYCLES);
+  if (first->CYCLES == ref->CYCLES && first->SP == ref->SP &&
+      first->DSTACK[first->SP - 1] == ref->DSTACK[ref->SP - 1] &&
+      second->CYCLES == taken_at && ctx->CYCLES == taken_at &&
+      second->EIP == ctx->EIP && !second->memory[4000] &&
+      !ctx->memory[4000]) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: cycles=%llu %llu %llu\n", first->CYCLES, second->CYCLES,
+           ctx->CYCLES);
+    passed = false;
+  }
+  vm_clone_release(first);
+  vm_clone_release(second);
+  vm_release(ref);
+  free(ref);
+  vm_release(ctx);
+  free(ctx);
+  return (passed);
+}
+
+// Lay out a word that recurses `depth` times before returning:
+//
+//   depth call sub halt
+//   sub: dup 0branch done 1- call sub
+//   done: exit
+static bool stack_recursion(context *ctx, int64_t depth) {
+  insert_literal(ctx, depth);
+  uint16_t call_site = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CALL, 0);
+  insert_uint16(ctx, 0);
+  uint16_t sub = ctx->HERE;
+  ((instruction *)&ctx->memory[call_site])->jmp.target = sub;
+  if (!compile_words(ctx, "dup")) {
+    return (false);
+  }
+  uint16_t branch = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CJMP, 0);
+  if (!compile_words(ctx, "1-")) {
+    return (false);
+  }
+  insert_jump(ctx, OP_TYPE_CALL, sub);
+  ((instruction *)&ctx->memory[branch])->jmp.target = ctx->HERE;
+  return (compile_words(ctx, "exit"));
+}
+
+// Running off either end of a stack must trap instead of corrupting the
+// context, and `vm_stacks()` must make room for deeper recursion.
+#define STACK_THREADS 4
+
+struct stack_run {
+  context *ctx;
+  int status;
+};
+
+static void *stack_run_thread(void *arg) {
+  struct stack_run *run = arg;
+  run->status = vm(run->ctx);
+  return (NULL);
+}
+
+bool execute_stack_tests(context *in_ctx) {
+  bool passed = true;
+
+  context *ctx = budget_context(in_ctx);
+  if (!compile_words(ctx, "noop 1")) {
+    return (false);
+  }
+  insert_jump(ctx, OP_TYPE_JMP, 1);
+  int overflow = vm(ctx);
+  vm_release(ctx);
+  free(ctx);
+
+  ctx = budget_context(in_ctx);
+  if (!compile(ctx, "drop drop drop")) {
+    return (false);
+  }
+  int underflow = vm(ctx);
+  vm_release(ctx);
+  free(ctx);
+
+  ctx = budget_context(in_ctx);
+  if (!stack_recursion(ctx, 1000)) {
+    return (false);
+  }
+  int shallow = vm(ctx);
+  int deep = vm_stacks(ctx, 64, 2000) ? vm(ctx) : -1;
+  printf("TEST: %-28s EXPECTED={overflow underflow overflow halted} => ",
+         "vm_stacks guard pages");
+  if (overflow == VM_STACK_OVERFLOW && underflow == VM_STACK_UNDERFLOW &&
+      shallow == VM_STACK_OVERFLOW && deep == VM_HALTED && ctx->RSP == 0 &&
+      ctx->SP == 1 && ctx->DSTACK[0] == 0 && ctx->RSTACK_DEPTH >= 2000) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d %d %d %d RSP=%d SP=%d\n", overflow, underflow, shallow,
+           deep, ctx->RSP, ctx->SP);
+    passed = false;
+  }
+  vm_release(ctx);
+  free(ctx);
+
+  // Threads overflowing their own stacks at once must each get their trap.
+  struct stack_run runs[STACK_THREADS];
+  pthread_t threads[STACK_THREADS];
+  for (int idx = 0; idx < STACK_THREADS; idx++) {
+    runs[idx].ctx = budget_context(in_ctx);
+    runs[idx].status = -1;
+    if (!compile_words(runs[idx].ctx, "noop 1")) {
+      return (false);
+    }
+    insert_jump(runs[idx].ctx, OP_TYPE_JMP, 1);
+  }
+  int started = 0;
+  while (started < STACK_THREADS &&
+         pthread_create(&threads[started], NULL, stack_run_thread,
+                        &runs[started]) == 0) {
+    started++;
+  }
+  bool trapped = started == STACK_THREADS;
+  for (int idx = 0; idx < STACK_THREADS; idx++) {
+    if (idx < started) {
+      pthread_join(threads[idx], NULL);
+    }
+    trapped = trapped && runs[idx].status == VM_STACK_OVERFLOW;
+    vm_release(runs[idx].ctx);
+    free(runs[idx].ctx);
+  }
+  printf("TEST: %-28s EXPECTED={overflow x%d} => ", "guard pages per thread",
+         STACK_THREADS);
+  if (trapped) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d threads started\n", started);
+    passed = false;
+  }
+  return (passed);
+}
+
+// `@` and `!` must reach memory mapped past the code cells, and clones
+// must see what was stored there.
+bool execute_memory_tests(context *in_ctx) {
+  context *ctx = budget_context(in_ctx);
+  if (!compile(ctx, "12345 33554432 ! 33554432 @")) {
+    return (false);
+  }
+  bool grown = vm_memory(ctx, 64 << 20, VM_MEMORY_HUGE);
+  int status = grown ? vm(ctx) : -1;
+  struct vm_snapshot *snap = vm_snapshot(ctx);
+  context *clone = snap ? vm_clone(snap) : NULL;
+  int64_t cloned =
+      clone ? *(int64_t *)((uint8_t *)clone->memory + 33554432) : -1;
+  printf("TEST: %-28s EXPECTED={halted 12345 12345} => ", "vm_memory 64MB");
+  bool passed = status == VM_HALTED && ctx->SP == 1 &&
+                ctx->DSTACK[0] == 12345 && cloned == 12345 &&
+                ctx->MEMORY_BYTES >= 64 << 20;
+  if (passed) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d SP=%d %lld %lld\n", status, ctx->SP,
+           (long long)ctx->DSTACK[0], (long long)cloned);
+  }
+  if (clone) vm_clone_release(clone);
+  if (snap) vm_snapshot_release(snap);
+  vm_release(ctx);
+  free(ctx);
+
+  // A bulk write that misses every header keeps the dictionary index; the
+  // headers are those of the search-wordlist tests in tests.h.
+  static const int64_t headers[] = {
+      24, 76966318133411840, 153685639156596745, 230616333069516816, 0,
+      8825217326060172644};
+  ctx = budget_context(in_ctx);
+  for (size_t idx = 0; idx < sizeof(headers) / sizeof(headers[0]); idx++) {
+    insert_int64(ctx, headers[idx]);
+  }
+  ctx->EIP = ctx->HERE;
+  if (!compile(ctx, "40 3 0 search-wordlist 2drop 40 48 3 cmove "
+                    "48 3 0 search-wordlist")) {
+    return (false);
+  }
+  status = vm(ctx);
+  printf("TEST: %-28s EXPECTED={819 -1, index kept} => ",
+         "cmove beside the dictionary");
+  bool kept = status == VM_HALTED && ctx->SP == 2 && ctx->DSTACK[0] == 819 &&
+              ctx->DSTACK[1] == -1 && ctx->dict != NULL;
+  if (kept) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d SP=%d index=%s\n", status, ctx->SP,
+           ctx->dict ? "kept" : "dropped");
+  }
+  vm_release(ctx);
+  free(ctx);
+  return (passed && kept);
+}
+
+// A device that adds what is written to it and reads back the total.
+static int64_t io_total_read(context *ctx, uint64_t port, void *data) {
+  return (*(int64_t *)data);
+}
+
+static int64_t io_total_write(context *ctx, uint64_t port, int64_t value,
+                              void *data) {
+  *(int64_t *)data += value;
+  return (true);
+}
+
+// Bytes written to the console's 0xf1, caught instead of printed.
+static int64_t io_capture_write(context *ctx, uint64_t port, int64_t value,
+                                void *data) {
+  char *captured = data;
+  captured[strlen(captured)] = (char)value;
+  return (true);
+}
+
+// Devices attached by the host must answer on low and hashed ports alike,
+// and may take over the console's ports.
+bool execute_io_tests(context *in_ctx) {
+  context *ctx = budget_context(in_ctx);
+  int64_t low = 0;
+  int64_t high = 0;
+  char captured[8] = {0};
+  if (!compile(ctx, "5 16 io! 7 17 io! 16 io@ 74565 io@ 3 74566 io! "
+                    "74565 io@ 72 241 io! 105 241 io! 32 io@")) {
+    return (false);
+  }
+  bool attached =
+      vm_io_attach(ctx, 16, 2, io_total_read, io_total_write, &low) &&
+      vm_io_attach(ctx, 74565, 2, io_total_read, io_total_write, &high) &&
+      vm_io_attach(ctx, 0xf1, 1, NULL, io_capture_write, captured);
+  int status = attached ? vm(ctx) : -1;
+  printf("TEST: %-28s EXPECTED={stack: [12 0 3 0] output: \"Hi\"} => ",
+         "vm_io_attach");
+  bool passed = status == VM_HALTED && ctx->SP == 4 &&
+                ctx->DSTACK[0] == 12 && ctx->DSTACK[1] == 0 &&
+                ctx->DSTACK[2] == 3 && ctx->DSTACK[3] == 0 &&
+                strcmp(captured, "Hi") == 0;
+  if (passed) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d SP=%d \"%s\"\n", status, ctx->SP, captured);
+  }
+  vm_release(ctx);
+  free(ctx);
+  return (passed);
+}
+
+// Lay out `setup`, then a loop that reads `port` and pauses while the read
+// would block, as nuc.fs's `io-wait@` does:
+//
+//   noop setup
+//   loop: port io@ dup -2 = 0branch done drop pause jmp loop
+//   done: halt
+//
+// The noop keeps `loop` off 0, where a jump would encode as a zero word.
+static bool blocking_read(context *ctx, const char *setup, int64_t port) {
+  if (!compile_words(ctx, "noop") || (*setup && !compile_words(ctx, setup))) {
+    return (false);
+  }
+  uint16_t loop = ctx->HERE;
+  insert_literal(ctx, port);
+  if (!compile_words(ctx, "io@ dup -2 =")) {
+    return (false);
+  }
+  uint16_t branch = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CJMP, 0);
+  if (!compile_words(ctx, "drop")) {
+    return (false);
+  }
+  insert_uint16(ctx, 0);
+  insert_jump(ctx, OP_TYPE_JMP, loop);
+  ((instruction *)&ctx->memory[branch])->jmp.target = ctx->HERE;
+  insert_uint16(ctx, 0);
+  return (true);
+}
+
+// The same loop with the branch the other way round, so that the taken
+// branch, where most engines check the budget, falls between the read and
+// the `pause`:
+//
+//   noop
+//   loop: port io@ dup -2 xor 0branch wait halt
+//   wait: drop pause jmp loop
+static bool blocking_read_inverted(context *ctx, int64_t port) {
+  if (!compile_words(ctx, "noop")) {
+    return (false);
+  }
+  uint16_t loop = ctx->HERE;
+  insert_literal(ctx, port);
+  if (!compile_words(ctx, "io@ dup -2 xor")) {
+    return (false);
+  }
+  uint16_t branch = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CJMP, 0);
+  insert_uint16(ctx, 0);
+  ((instruction *)&ctx->memory[branch])->jmp.target = ctx->HERE;
+  if (!compile_words(ctx, "drop")) {
+    return (false);
+  }
+  insert_uint16(ctx, 0);
+  insert_jump(ctx, OP_TYPE_JMP, loop);
+  return (true);
+}
+
+// A context reading a non-blocking pipe that returns `VM_BLOCKED` until
+// the pipe has input for it, then carries on with the read.
+static context *blocking_context(context *in_ctx, int fds[2]) {
+  context *ctx = budget_context(in_ctx);
+  if (pipe(fds) != 0) {
+    return (ctx);
+  }
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  ctx->IN = fdopen(fds[0], "r");
+  return (ctx);
+}
+
+// A read from input that isn't ready must suspend the run rather than the
+// host, and resume with the read once there is input, for `key` and for a
+// line arriving in pieces alike.
+bool execute_blocking_tests(context *in_ctx) {
+  int fds[2];
+  context *ctx = blocking_context(in_ctx, fds);
+  if (!blocking_read(ctx, "", 0xe0)) {
+    return (false);
+  }
+  int waiting = vm_run(ctx, 1000);
+  int waiting_fd = ctx->WAIT_FD;
+  int again = vm_run(ctx, 1000);
+  write(fds[1], "A", 1);
+  int done = vm_run(ctx, 1000);
+  printf("TEST: %-28s EXPECTED={blocked blocked halted 65} => ",
+         "key on a non-blocking pipe");
+  bool passed = waiting == VM_BLOCKED && waiting_fd == fds[0] &&
+                again == VM_BLOCKED && done == VM_HALTED && ctx->SP == 1 &&
+                ctx->DSTACK[0] == 'A';
+  if (passed) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d %d %d SP=%d\n", waiting, again, done, ctx->SP);
+  }
+  fclose(ctx->IN);
+  close(fds[1]);
+  vm_release(ctx);
+  free(ctx);
+
+  // However the budget slices the loop, a read that would block ends a
+  // run only at the `pause`, and the read after it gets the key.
+  bool sliced_passed = true;
+  for (int inverted = 0; inverted <= 1; inverted++) {
+    for (uint64_t budget = 1; budget <= 16; budget++) {
+      ctx = blocking_context(in_ctx, fds);
+      if (inverted ? !blocking_read_inverted(ctx, 0xe0)
+                   : !blocking_read(ctx, "", 0xe0)) {
+        return (false);
+      }
+      int status;
+      int blocked = 0;
+      int runs = 0;
+      while ((status = vm_run(ctx, budget)) == VM_PREEMPTED ||
+             status == VM_BLOCKED) {
+        if (status == VM_BLOCKED && ++blocked == 2) {
+          write(fds[1], "A", 1);
+        }
+        if (++runs > 1000) {
+          break;
+        }
+      }
+      if (status != VM_HALTED || blocked != 2 || ctx->SP != 1 ||
+          ctx->DSTACK[0] != 'A') {
+        printf("TEST: %-28s EXPECTED={halted 65} => FAILED: budget %llu%s "
+               "%d blocked %d SP=%d T=%lld\n", "key sliced by the budget",
+               budget, inverted ? " inverted" : "", status, blocked, ctx->SP,
+               ctx->SP > 0 ? ctx->DSTACK[ctx->SP - 1] : 0);
+        sliced_passed = false;
+      }
+      fclose(ctx->IN);
+      close(fds[1]);
+      vm_release(ctx);
+      free(ctx);
+    }
+  }
+  if (sliced_passed) {
+    printf("TEST: %-28s EXPECTED={halted 65} => PASSED\n",
+           "key sliced by the budget");
+  }
+
+  ctx = blocking_context(in_ctx, fds);
+  if (!blocking_read(ctx, "100000 225 io! 16 226 io!", 0xe2)) {
+    return (false);
+  }
+  write(fds[1], "he\tl", 4);
+  waiting = vm_run(ctx, 1000);
+  write(fds[1], "lo\nnext", 8);
+  done = vm_run(ctx, 1000);
+  char *line = (char *)ctx->memory + 100000;
+  printf("TEST: %-28s EXPECTED={blocked halted 6 \"he llo\"} => ",
+         "line read in pieces");
+  bool line_passed = waiting == VM_BLOCKED && done == VM_HALTED &&
+                     ctx->SP == 1 && ctx->DSTACK[0] == 6 &&
+                     memcmp(line, "he llo", 6) == 0;
+  if (line_passed) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d %d SP=%d \"%.6s\"\n", waiting, done, ctx->SP, line);
+  }
+  fclose(ctx->IN);
+  close(fds[1]);
+  vm_release(ctx);
+  free(ctx);
+
+  // A line read over code that has already run must run as read, not as
+  // the engine translated it before:
+  //
+  //   noop
+  //   1: 1 halt
+  //   3: 2 225 io! 2 226 io! 226 io@ drop jmp 1
+  //
+  // run once from 0, then from 3 with "A\x80", the literal 65, to read.
+  ctx = blocking_context(in_ctx, fds);
+  if (!compile_words(ctx, "noop 1")) {
+    return (false);
+  }
+  insert_uint16(ctx, 0);
+  uint16_t reader = ctx->HERE;
+  if (!compile_words(ctx, "2 225 io! 2 226 io! 226 io@ drop")) {
+    return (false);
+  }
+  insert_jump(ctx, OP_TYPE_JMP, 1);
+  int first = vm(ctx);
+  int64_t before = ctx->DSTACK[0];
+  write(fds[1], "A\x80\n", 3);
+  ctx->EIP = reader;
+  done = vm(ctx);
+  printf("TEST: %-28s EXPECTED={1, then 65} => ", "line read over code");
+  bool code_passed = first == VM_HALTED && before == 1 && done == VM_HALTED &&
+                     ctx->SP == 1 && ctx->DSTACK[0] == 65;
+  if (code_passed) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d %lld %d SP=%d T=%lld\n", first, before, done, ctx->SP,
+           ctx->DSTACK[ctx->SP > 0 ? ctx->SP - 1 : 0]);
+  }
+  fclose(ctx->IN);
+  close(fds[1]);
+  vm_release(ctx);
+  free(ctx);
+  return (passed && sliced_passed && line_passed && code_passed);
+}
+
+// A small cross.fs image: code, a gap, some data, and one dictionary entry
+// naming cell 2 `sq`, with the last cell pointing at the entry.
+static const uint16_t IMAGE_CELLS[] = {
+    0x1111, 0x2222, 0x3333, 0x4444, 0, 0, 0x5555, 0x6666,
+    0x7777, 0x8888, 0, 2 | 's' << 8, 'q', 4, 20, 0};
+#define IMAGE_CELL_COUNT (sizeof(IMAGE_CELLS) / sizeof(uint16_t))
+
+#ifdef HEX2IMG
+// Run hex2img over `IMAGE_CELLS` written out as `path`, leaving the image
+// at `path` with `.img` appended.
+static bool image_convert(const char *path, char *img, size_t img_size) {
+  FILE *hex = fopen(path, "w");
+  if (!hex) {
+    return (false);
+  }
+  for (size_t idx = 0; idx < IMAGE_CELL_COUNT; idx += 2) {
+    fprintf(hex, "%08x\n", IMAGE_CELLS[idx] | IMAGE_CELLS[idx + 1] << 16);
+  }
+  fclose(hex);
+  snprintf(img, img_size, "%s.img", path);
+  char command[512];
+  snprintf(command, sizeof(command), "'%s' '%s' '%s' > /dev/null", HEX2IMG,
+           path, img);
+  return (system(command) == 0);
+}
+#endif // HEX2IMG
+
+// An image hex2img writes must load back to the same memory and symbols,
+// and one whose section would reach past memory must not load at all.
+bool execute_image_tests(context *in_ctx) {
+  bool passed = true;
+  char path[] = "/tmp/hexaforth_imageXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    printf("TEST: Failed to create an image file\n");
+    return (false);
+  }
+  close(fd);
+#ifdef HEX2IMG
+  char img[sizeof(path) + 4];
+  context *ctx = vm_new();
+  bool converted = image_convert(path, img, sizeof(img));
+  bool loaded = converted && vm_image_load(ctx, img);
+  printf("TEST: %-28s EXPECTED={here: %zu, cell 2: sq} => ",
+         "hex2img round trip", IMAGE_CELL_COUNT);
+  if (loaded && ctx->HERE == IMAGE_CELL_COUNT &&
+      memcmp(ctx->memory, IMAGE_CELLS, sizeof(IMAGE_CELLS)) == 0 &&
+      ctx->meta && ctx->meta[2] && strcmp(ctx->meta[2], "sq") == 0) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: converted=%d loaded=%d here=%u\n", converted, loaded,
+           ctx->HERE);
+    passed = false;
+  }
+  unlink(img);
+  vm_release(ctx);
+  free(ctx);
+#endif // HEX2IMG
+
+  image_header header = {};
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  for (int idx = 0; idx < IMAGE_SECTION_COUNT; idx++) {
+    header.sections[idx].offset = sizeof(header);
+  }
+  header.sections[IMAGE_CODE] = (image_section){sizeof(header), 4,
+                                                 UINT32_MAX, 2};
+  uint16_t cells[2] = {0x1234, 0x5678};
+  FILE *file = fopen(path, "wb");
+  bool written = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(cells, sizeof(cells), 1, file) == 1;
+  if (file) {
+    fclose(file);
+  }
+  context *bad = vm_new();
+  printf("TEST: %-28s EXPECTED={rejected} => ", "image section past memory");
+  if (written && !vm_image_load(bad, path) && bad->memory[0] == 0) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED\n");
+    passed = false;
+  }
+  vm_release(bad);
+  free(bad);
+
+  // The same cells at 0 make a valid image, with no symbols to keep it
+  // mapped.
+  header.here = 2;
+  header.sections[IMAGE_CODE].base = 0;
+  file = fopen(path, "wb");
+  written = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(cells, sizeof(cells), 1, file) == 1;
+  if (file) {
+    fclose(file);
+  }
+  context *plain = vm_new();
+  printf("TEST: %-28s EXPECTED={here: 2, 0x1234 0x5678} => ",
+         "image without symbols");
+  if (written && vm_image_load(plain, path) && plain->HERE == 2 &&
+      plain->memory[0] == 0x1234 && plain->memory[1] == 0x5678) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED\n");
+    passed = false;
+  }
+  unlink(path);
+  vm_release(plain);
+  free(plain);
+  return (passed);
+}
+
+#ifdef HEX2C
+// Lay out a program that leaves its final stack where a translated binary
+// can show it, in its output: a countdown summing into memory through a
+// subroutine, some arithmetic, and then the stack written out cell by cell.
+//
+//   noop 0 4000 ! 10
+//   loop: call sub 1- dup 0branch done jmp loop
+//   done: drop 4000 @ dup 123456789 * 3 4 swap - 8emit 8emit 8emit halt
+//   sub:  dup 4000 +! exit
+static bool aot_program(context *ctx) {
+  if (!compile_words(ctx, "noop 0 4000 ! 10")) {
+    return (false);
+  }
+  uint16_t loop = ctx->HERE;
+  uint16_t call_site = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CALL, 0);
+  if (!compile_words(ctx, "1- dup")) {
+    return (false);
+  }
+  uint16_t branch = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CJMP, 0);
+  insert_jump(ctx, OP_TYPE_JMP, loop);
+  ((instruction *)&ctx->memory[branch])->jmp.target = ctx->HERE;
+  if (!compile_words(ctx, "drop 4000 @ dup 123456789 * 3 4 swap - "
+                          "8emit 8emit 8emit")) {
+    return (false);
+  }
+  insert_uint16(ctx, 0);
+  ((instruction *)&ctx->memory[call_site])->jmp.target = ctx->HERE;
+  return (compile_words(ctx, "dup 4000 +! exit"));
+}
+
+// Translate the code `ctx` compiled with hex2c, build it against the AOT
+// runtime and run it, reading back what it wrote to stdout and stderr.
+static bool aot_run(context *ctx, const char *path, char *out, size_t size,
+                    char *err, size_t err_size) {
+  char file[512];
+  snprintf(file, sizeof(file), "%s.hex", path);
+  FILE *hex = fopen(file, "w");
+  if (!hex) {
+    return (false);
+  }
+  for (uint32_t idx = 0; idx < ctx->HERE; idx += 2) {
+    fprintf(hex, "%08x\n", ctx->memory[idx] | ctx->memory[idx + 1] << 16);
+  }
+  fclose(hex);
+  char command[2048];
+  snprintf(command, sizeof(command),
+           "'%s' '%s.hex' '%s.c' > /dev/null && "
+           "%s -o '%s' '%s.c' %s && '%s' < /dev/null > '%s.out' 2> '%s.err'",
+           HEX2C, path, path, AOT_COMPILE, path, path, AOT_RUNTIME, path,
+           path, path);
+  bool ran = system(command) == 0;
+  const char *suffixes[] = {".out", ".err"};
+  char *buffers[] = {out, err};
+  size_t sizes[] = {size, err_size};
+  for (int idx = 0; idx < 2; idx++) {
+    snprintf(file, sizeof(file), "%s%s", path, suffixes[idx]);
+    FILE *in = fopen(file, "r");
+    size_t got = in ? fread(buffers[idx], 1, sizes[idx] - 1, in) : 0;
+    buffers[idx][got] = '\0';
+    if (in) {
+      fclose(in);
+    }
+    unlink(file);
+  }
+  const char *extensions[] = {".hex", ".c", ""};
+  for (int idx = 0; idx < 3; idx++) {
+    snprintf(file, sizeof(file), "%s%s", path, extensions[idx]);
+    unlink(file);
+  }
+  return (ran);
+}
+
+// A binary hex2c and the AOT runtime build must end a program as the
+// switch engine does, with the same output and instruction count, and
+// trap a stack overflow as the other engines do.
+bool execute_aot_tests(context *in_ctx) {
+  bool passed = true;
+  for (int overflow = 0; overflow <= 1; overflow++) {
+    context *ref = budget_context(in_ctx);
+    context *ctx = budget_context(in_ctx);
+    ref->engine = ENGINE_SWITCH;
+    bool compiled;
+    if (overflow) {
+      // noop loop: dup jmp loop
+      compiled = compile_words(ref, "noop dup");
+      insert_jump(ref, OP_TYPE_JMP, 1);
+    } else {
+      compiled = aot_program(ref);
+    }
+    memcpy(ctx->memory, ref->memory, ref->HERE * sizeof(uint16_t));
+    ctx->HERE = ref->HERE;
+    char *expected = NULL;
+    size_t expected_len = 0;
+    ref->OUT = open_memstream(&expected, &expected_len);
+    int status = compiled ? vm(ref) : VM_HALTED;
+    fprintf(ref->OUT, "\n[%lld instructions executed]\n", ref->CYCLES);
+    fclose(ref->OUT);
+    char path[] = "/tmp/hexaforth_aotXXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    char out[256];
+    char err[256];
+    bool ran = compiled && fd >= 0 &&
+               aot_run(ctx, path, out, sizeof(out), err, sizeof(err));
+    const char *trap = status == VM_STACK_OVERFLOW ? "\nStack overflow\n" : "";
+    printf("TEST: %-28s EXPECTED={%s} => ",
+           overflow ? "hex2c stack overflow" : "hex2c against switch",
+           overflow ? "stack overflow" : "same output");
+    if (ran && (status == VM_HALTED || overflow) &&
+        strcmp(out, expected) == 0 && strcmp(err, trap) == 0) {
+      printf("PASSED\n");
+    } else {
+      printf("FAILED: ran=%d status=%d\n", ran, status);
+      passed = false;
+    }
+    free(expected);
+    vm_release(ref);
+    free(ref);
+    vm_release(ctx);
+    free(ctx);
+  }
+  return (passed);
+}
+#endif // HEX2C
+
+#ifdef HEXAFORTH_SERVER
+// Write the code `ctx` compiled as an image with only a code section.
+static bool server_image(context *ctx, const char *path) {
+  image_header header = {};
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  header.here = ctx->HERE;
+  uint32_t offset = sizeof(header) + ctx->HERE * sizeof(uint16_t);
+  for (int idx = 0; idx < IMAGE_SECTION_COUNT; idx++) {
+    header.sections[idx] = (image_section){offset, 0, ctx->HERE, 0};
+  }
+  header.sections[IMAGE_CODE] = (image_section){
+      sizeof(header), ctx->HERE * sizeof(uint16_t), 0, ctx->HERE};
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return (false);
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(ctx->memory, sizeof(uint16_t), ctx->HERE, file) ==
+                     ctx->HERE;
+  return (fclose(file) == 0 && written);
+}
+
+// Connect to the server's socket, giving it a moment to start listening.
+static int server_connect(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  for (int tries = 0; tries < 200; tries++) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      return (fd);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    usleep(10000);
+  }
+  return (-1);
+}
+
+// Send `c` and return the byte the session answers with, 0 at the end of
+// the session, or -1 if it doesn't answer within a couple of seconds.
+static int server_exchange(int fd, char c) {
+  if (c && send(fd, &c, 1, MSG_NOSIGNAL) != 1) {
+    return (-1);
+  }
+  struct pollfd ready = {.fd = fd, .events = POLLIN};
+  char answer;
+  if (poll(&ready, 1, 2000) != 1) {
+    return (-1);
+  }
+  ssize_t got = recv(fd, &answer, 1, 0);
+  return (got == 1 ? (uint8_t)answer : got == 0 ? 0 : -1);
+}
+
+// Each connection to hexaforth-server must get its own VM: an image that
+// counts the bytes it reads, echoing the count, answers two interleaved
+// clients with counts of their own, and ends a client's session alone.
+//
+//   noop
+//   loop: 224 io@ dup -2 = 0branch got drop pause jmp loop
+//   got:  dup 0< 0branch count halt
+//   count: drop 60000 @ 1 + dup 60000 ! 48 + 241 io! jmp loop
+bool execute_server_tests(context *in_ctx) {
+  context *ctx = budget_context(in_ctx);
+  if (!compile_words(ctx, "noop")) {
+    return (false);
+  }
+  uint16_t loop = ctx->HERE;
+  insert_literal(ctx, 0xe0);
+  if (!compile_words(ctx, "io@ dup -2 =")) {
+    return (false);
+  }
+  uint16_t got = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CJMP, 0);
+  if (!compile_words(ctx, "drop")) {
+    return (false);
+  }
+  insert_uint16(ctx, 0);
+  insert_jump(ctx, OP_TYPE_JMP, loop);
+  ((instruction *)&ctx->memory[got])->jmp.target = ctx->HERE;
+  if (!compile_words(ctx, "dup 0<")) {
+    return (false);
+  }
+  uint16_t count = ctx->HERE;
+  insert_jump(ctx, OP_TYPE_CJMP, 0);
+  insert_uint16(ctx, 0);
+  ((instruction *)&ctx->memory[count])->jmp.target = ctx->HERE;
+  if (!compile_words(ctx, "drop 60000 @ 1 + dup 60000 ! 48 + 241 io!")) {
+    return (false);
+  }
+  insert_jump(ctx, OP_TYPE_JMP, loop);
+
+  char image[] = "/tmp/hexaforth_serverXXXXXX";
+  int fd = mkstemp(image);
+  if (fd >= 0) {
+    close(fd);
+  }
+  char socket_path[sizeof(image) + 5];
+  snprintf(socket_path, sizeof(socket_path), "%s.sock", image);
+  bool written = fd >= 0 && server_image(ctx, image);
+  vm_release(ctx);
+  free(ctx);
+  pid_t server = written ? fork() : -1;
+  if (server == 0) {
+    setenv("HEXAFORTH_ENGINE", VM_ENGINE_REPR[in_ctx->engine], 1);
+    execl(HEXAFORTH_SERVER, HEXAFORTH_SERVER, image, socket_path, "2",
+          (char *)NULL);
+    _exit(127);
+  }
+  int first = server > 0 ? server_connect(socket_path) : -1;
+  int second = first >= 0 ? server_connect(socket_path) : -1;
+  int answers[6] = {-1, -1, -1, -1, -1, -1};
+  if (first >= 0 && second >= 0) {
+    answers[0] = server_exchange(first, 'a');
+    answers[1] = server_exchange(second, 'b');
+    answers[2] = server_exchange(first, 'a');
+    answers[3] = server_exchange(first, 'a');
+    shutdown(first, SHUT_WR);
+    answers[4] = server_exchange(first, 0);
+    answers[5] = server_exchange(second, 'b');
+  }
+  printf("TEST: %-28s EXPECTED={1 1 2 3 end 2} => ", "server sessions");
+  bool passed = answers[0] == '1' && answers[1] == '1' &&
+                answers[2] == '2' && answers[3] == '3' && answers[4] == 0 &&
+                answers[5] == '2';
+  if (passed) {
+    printf("PASSED\n");
+  } else {
+    printf("FAILED: %d %d %d %d %d %d\n", answers[0], answers[1], answers[2],
+           answers[3], answers[4], answers[5]);
+  }
+  if (first >= 0) close(first);
+  if (second >= 0) close(second);
+  if (server > 0) {
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+  }
+  unlink(socket_path);
+  unlink(image);
+  return (passed);
+}
+#endif // HEXAFORTH_SERVER
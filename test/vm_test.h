@@ -27,5 +27,19 @@ typedef struct {
 
 bool execute_test(context *ctx, hexaforth_test test);
 bool execute_tests(context *ctx, hexaforth_test *tests);
+bool execute_budget_tests(context *ctx);
+bool execute_trace_tests(context *ctx);
+bool execute_snapshot_tests(context *ctx);
+bool execute_stack_tests(context *ctx);
+bool execute_memory_tests(context *ctx);
+bool execute_io_tests(context *ctx);
+bool execute_blocking_tests(context *ctx);
+bool execute_image_tests(context *ctx);
+#ifdef HEX2C
+bool execute_aot_tests(context *ctx);
+#endif // HEX2C
+#ifdef HEXAFORTH_SERVER
+bool execute_server_tests(context *ctx);
+#endif // HEXAFORTH_SERVER
 
 #endif // HEXAFORTH_VM_TEST_H
@@ -0,0 +1,38 @@
+//
+// aot_main.c - runtime for images translated to C by hex2c.
+//
+// Loads the translated image's data into a fresh context with default
+// stacks and runs it, guarded like the other engines, with the io ports
+// served by vm.c as usual.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../vm.h"
+
+extern const int AOT_IMAGE_CELLS;
+extern const uint16_t AOT_IMAGE[];
+int vm_aot(context *ctx);
+
+int main(int argc, char *argv[]) {
+    context *ctx = vm_new();
+    if (!ctx || !vm_stacks(ctx, VM_STACK_CELLS, VM_STACK_CELLS)) {
+        fprintf(stderr, "Can't allocate a context\n");
+        return EXIT_FAILURE;
+    }
+    memcpy(ctx->memory, AOT_IMAGE, AOT_IMAGE_CELLS * sizeof(uint16_t));
+    ctx->HERE = AOT_IMAGE_CELLS;
+    ctx->OUT = stdout;
+    ctx->IN = stdin;
+    int status = vm_stacks_guard(ctx, vm_aot);
+    if (status == VM_STACK_OVERFLOW || status == VM_STACK_UNDERFLOW) {
+        vm_out_flush(ctx);
+        fprintf(stderr, "\nStack %s\n",
+                status == VM_STACK_OVERFLOW ? "overflow" : "underflow");
+    }
+    printf("\n[%lld instructions executed]\n", ctx->CYCLES);
+    vm_release(ctx);
+    free(ctx);
+    return 0;
+}
@@ -0,0 +1,66 @@
+//
+// handler_table_gen.c - writes vm_handlers_gen.c, the 64K handler table.
+//
+// Every ALU encoding gets its own handler with its fields as constants;
+// literal and jump encodings map to the shared handlers in vm_handlers.h.
+//
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "../vm_instruction.h"
+
+static void handler_name(char* out, uint16_t raw) {
+    instruction ins = *(instruction*)&raw;
+    if (ins.lit.lit_f) {
+        sprintf(out, "vm_lit_%s%d",
+                ins.lit.lit_add ? "add_" : "",
+                ins.lit.lit_shifts);
+    } else switch (ins.alu.op_type) {
+        case OP_TYPE_JMP:  sprintf(out, "vm_jmp"); break;
+        case OP_TYPE_CJMP: sprintf(out, "vm_cjmp"); break;
+        case OP_TYPE_CALL: sprintf(out, "vm_call"); break;
+        case OP_TYPE_ALU:  sprintf(out, "vm_alu_%04x", raw); break;
+    }
+}
+
+void generate_handler_table(const char* path) {
+    FILE* out = fopen(path, "w");
+
+    fprintf(out, "// Generated by handler-table-gen; do not edit.\n\n");
+    fprintf(out, "#include \"vm_handlers.h\"\n\n");
+    for (int shifts = 0; shifts < 4; shifts++) {
+        fprintf(out, "HANDLER_LIT(%d)\n", shifts);
+    }
+    fprintf(out, "\n");
+
+    // ALU handlers: in_mux, alu_op, out_mux, dstack, rstack, r_eip
+    for (uint32_t raw = 0x6000; raw < 0x8000; raw++) {
+        uint16_t cell = raw;
+        instruction ins = *(instruction*)&cell;
+        fprintf(out, "HANDLER_ALU(%04x, %d, %2d, %d, %2d, %2d, %d)\n",
+                raw,
+                ins.alu.in_mux,
+                ins.alu.alu_op,
+                ins.alu.out_mux,
+                ins.alu.dstack,
+                ins.alu.rstack,
+                ins.alu.r_eip);
+    }
+
+    fprintf(out, "\nconst vm_handler VM_HANDLERS[65536] = {\n");
+    for (uint32_t raw = 0; raw < 0x10000; raw++) {
+        char name[32];
+        handler_name(name, raw);
+        fprintf(out, "%s%s,%s",
+                raw % 4 ? "" : "    ",
+                name,
+                raw % 4 == 3 ? "\n" : " ");
+    }
+    fprintf(out, "};\n");
+    fclose(out);
+}
+
+int main(int argc, char *argv[]) {
+    generate_handler_table(argv[1]);
+    return(0);
+}
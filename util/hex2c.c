@@ -0,0 +1,165 @@
+//
+// hex2c.c - ahead-of-time translator from a .hex image to C.
+//
+// Every cell of the image becomes a labeled block inside one function,
+// `vm_aot()`: literals are folded to constants, jumps and calls become
+// gotos, and ALU instructions call `vm_alu()` from vm_handlers.h with their
+// fields as constants.  A return, or anything else that sets EIP from R,
+// goes through a `switch` on EIP back to the labels.  The image itself is
+// emitted as `AOT_IMAGE[]` so the runtime (util/aot_main.c) can load the
+// data it reads and writes; the runtime also gives the context its stacks
+// and runs `vm_aot()` under `vm_stacks_guard()`.
+//
+// The translation assumes the image never rewrites its own code.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../vm_instruction.h"
+
+static int load_hex_file(const char *filename, uint16_t *memory) {
+  FILE *f = fopen(filename, "r");
+  if (!f)
+    return -1;
+
+  int addr = 0;
+  char line[100];
+  while (fgets(line, sizeof(line), f) && addr < 65536) {
+    line[strcspn(line, "\n")] = 0;
+    // Each line has 8 hex chars = 2 16-bit words, last 4 chars first.
+    if (strlen(line) == 8) {
+      uint32_t value;
+      if (sscanf(line, "%8x", &value) == 1) {
+        memory[addr++] = value & 0xFFFF;
+        memory[addr++] = (value >> 16) & 0xFFFF;
+      }
+    }
+  }
+  fclose(f);
+  return addr;
+}
+
+static void translate_cell(FILE *out, uint16_t addr, uint16_t raw) {
+  instruction ins = *(instruction *)&raw;
+  uint16_t next = addr + 1;
+
+  fprintf(out, "L_%04x:\n", addr);
+  if (!raw) {
+    fprintf(out, "    r.EIP = 0x%04x; goto halt;\n", addr);
+    return;
+  }
+  fprintf(out, "    cycles++;\n");
+  if (ins.lit.lit_f) {
+    uint64_t lit = (uint64_t)ins.lit.lit_v << (ins.lit.lit_shifts * LIT_BITS);
+    if (ins.lit.lit_add) {
+      fprintf(out, "    r.T += 0x%llxLL;\n", (unsigned long long)lit);
+    } else {
+      fprintf(out, "    ctx->DSTACK[r.SP-1] = r.T; r.SP++; "
+                   "r.T = 0x%llxLL;\n",
+              (unsigned long long)lit);
+    }
+    return;
+  }
+  switch (ins.alu.op_type) {
+  case OP_TYPE_JMP:
+    fprintf(out, "    goto L_%04x;\n", ins.jmp.target);
+    break;
+  case OP_TYPE_CJMP:
+    fprintf(out, "    r.SP--; RES = r.T; r.T = ctx->DSTACK[r.SP-1]; "
+                 "if (!RES) goto L_%04x;\n",
+            ins.jmp.target);
+    break;
+  case OP_TYPE_CALL:
+    fprintf(out, "    ctx->RSTACK[r.RSP-1] = r.R; r.R = 0x%04x; "
+                 "ctx->RSTACK[r.RSP] = 0x%04x; r.RSP++; goto L_%04x;\n",
+            next, next, ins.jmp.target);
+    break;
+  case OP_TYPE_ALU:
+    if (ins.alu.out_mux == OUTPUT_IO_T) {
+      fprintf(out, "    r.EIP = 0x%04x;\n", next);
+    }
+    fprintf(out, "    vm_alu(&r, %d, %d, %d, %d, %d, %d);\n", ins.alu.in_mux,
+            ins.alu.alu_op, ins.alu.out_mux, ins.alu.dstack, ins.alu.rstack,
+            ins.alu.r_eip);
+    if (ins.alu.r_eip) {
+      fprintf(out, "    goto dispatch;\n");
+    }
+    break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("Usage: %s <hexfile> <output.c>\n", argv[0]);
+    printf("Translates a hex image into C for util/aot_main.c\n");
+    return 1;
+  }
+
+  uint16_t *memory = calloc(65536, sizeof(uint16_t));
+  int cells = load_hex_file(argv[1], memory);
+  if (cells < 0) {
+    perror("Cannot open hex file");
+    return 1;
+  }
+  FILE *out = fopen(argv[2], "w");
+  if (!out) {
+    perror("Cannot open output file");
+    return 1;
+  }
+
+  fprintf(out, "// Generated by hex2c from %s; do not edit.\n\n", argv[1]);
+  fprintf(out, "#include \"vm_handlers.h\"\n\n");
+  fprintf(out, "const int AOT_IMAGE_CELLS = %d;\n", cells);
+  fprintf(out, "const uint16_t AOT_IMAGE[%d] = {\n", cells ? cells : 1);
+  for (int addr = 0; addr < cells; addr++) {
+    fprintf(out, "%s0x%04x,%s", addr % 8 ? "" : "    ", memory[addr],
+            addr % 8 == 7 ? "\n" : " ");
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "int vm_aot(context *ctx) {\n"
+               "    vm_regs r = {\n"
+               "            .ctx = ctx,\n"
+               "            .T = ctx->DSTACK[0],\n"
+               "            .R = ctx->RSTACK[0],\n"
+               "            .EIP = ctx->EIP,\n"
+               "            .SP = 0,\n"
+               "            .RSP = 0 };\n"
+               "    uint64_t cycles = ctx->CYCLES;\n"
+               "    bool RES;\n\n");
+
+  fprintf(out, "dispatch:\n    switch ((uint16_t)r.EIP) {\n");
+  for (int addr = 0; addr < cells; addr++) {
+    fprintf(out, "        case 0x%04x: goto L_%04x;\n", addr, addr);
+  }
+  fprintf(out, "        default:\n"
+               "            if (ctx->memory[(uint16_t)r.EIP]) {\n"
+               "                fprintf(stderr, \"EIP 0x%%04x is outside the "
+               "translated image\\n\", (uint16_t)r.EIP);\n"
+               "            }\n"
+               "            goto halt;\n"
+               "    }\n\n");
+
+  for (int addr = 0; addr < cells; addr++) {
+    translate_cell(out, addr, memory[addr]);
+  }
+  // Running off the end of the image reaches zeroed memory: halt.
+  fprintf(out, "    r.EIP = 0x%04x;\n", cells);
+
+  fprintf(out, "halt:\n"
+               "    ctx->CYCLES = cycles;\n"
+               "    ctx->DSTACK[r.SP-1] = r.T;\n"
+               "    ctx->RSTACK[r.RSP-1] = r.R;\n"
+               "    ctx->SP = r.SP;\n"
+               "    ctx->RSP = r.RSP;\n"
+               "    ctx->EIP = r.EIP;\n"
+               "    vm_out_flush(ctx);\n"
+               "    return 1;\n"
+               "}\n");
+  fclose(out);
+  free(memory);
+  return 0;
+}
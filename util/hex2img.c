@@ -0,0 +1,155 @@
+//
+// hex2img.c - converts a cross.fs .hex image to the binary .img format.
+//
+// Usage: hex2img <hexfile> <imgfile> [lstfile]
+//
+// Reads the image the way `load_hex()` in main.c does, names each word's
+// code address from the dictionary, and writes the sections and symbols
+// described in vm_image.h.  Entries in the optional .lst file name the
+// dictionary headers that cross.fs listed, where no word's code is.  Only
+// cells below `IMAGE_SYMBOL_CELLS` are named, as for `load_hex()`.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../vm_image.h"
+
+#define CELLS 65536
+
+static uint16_t memory[CELLS];
+static char *meta[CELLS];
+
+static uint16_t read_counted_string(const uint8_t *ptr, char *str) {
+  uint8_t len = *ptr;
+  memcpy(str, ptr + 1, len);
+  str[len] = '\0';
+  return (len + 1 + ((len + 1) % 2));
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <hexfile> <imgfile> [lstfile]\n", argv[0]);
+    return (1);
+  }
+  FILE *hexfile = fopen(argv[1], "r");
+  if (!hexfile) {
+    perror(argv[1]);
+    return (1);
+  }
+  uint32_t here = 0;
+  uint32_t last_addr = 0;
+  int first_gap = -1;
+  char line[100];
+  while (here < CELLS && fgets(line, sizeof(line), hexfile)) {
+    *(uint32_t *)&memory[here] = (uint32_t)strtol(line, NULL, 16);
+    if (memory[here + 1]) {
+      last_addr = here + 1;
+    } else if (memory[here]) {
+      last_addr = here;
+    } else if (first_gap <= 0 && here + 4 <= CELLS &&
+               !*(uint64_t *)&memory[here]) {
+      first_gap = here;
+    }
+    here += 2;
+  }
+  fclose(hexfile);
+
+  // Walk the dictionary from the newest entry, as load_hex() does.
+  uint32_t code_end = first_gap > 0 ? first_gap : here;
+  uint32_t dp0 = here;
+  uint16_t next_ptr = memory[last_addr] / 2;
+  for (uint32_t words = 0; next_ptr && next_ptr < here && words < CELLS;
+       words++) {
+    char word[256];
+    uint16_t text_cells =
+        read_counted_string((uint8_t *)&memory[next_ptr + 1], word) / 2;
+    uint16_t code_addr = memory[next_ptr + text_cells + 1] / 2;
+    if (code_addr < IMAGE_SYMBOL_CELLS && !meta[code_addr]) {
+      meta[code_addr] = strdup(word);
+    }
+    dp0 = next_ptr;
+    next_ptr = memory[next_ptr] / 2;
+  }
+  if (dp0 < code_end) {
+    dp0 = code_end;
+  }
+
+  if (argc > 3) {
+    FILE *lst = fopen(argv[3], "r");
+    if (!lst) {
+      perror(argv[3]);
+      return (1);
+    }
+    while (fgets(line, sizeof(line), lst)) {
+      unsigned int addr;
+      char name[64];
+      if (sscanf(line, "%x %63s", &addr, name) == 2 &&
+          addr / 2 < IMAGE_SYMBOL_CELLS && !meta[addr / 2]) {
+        meta[addr / 2] = strdup(name);
+      }
+    }
+    fclose(lst);
+  }
+
+  image_header header = {};
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  header.here = here;
+  uint32_t bounds[IMAGE_SYMBOLS + 1] = {0, code_end, dp0, here};
+  uint32_t offset = sizeof(header);
+  for (int idx = IMAGE_CODE; idx <= IMAGE_DICT; idx++) {
+    image_section *section = &header.sections[idx];
+    section->base = bounds[idx];
+    section->count = bounds[idx + 1] - bounds[idx];
+    section->size = section->count * sizeof(uint16_t);
+    section->offset = offset;
+    offset += section->size;
+  }
+  uint32_t symbol_count = 0;
+  for (uint32_t addr = 0; addr < CELLS; addr++) {
+    symbol_count += meta[addr] != NULL;
+  }
+  image_section *symbols = &header.sections[IMAGE_SYMBOLS];
+  symbols->offset = offset;
+  symbols->count = symbol_count;
+  uint32_t name = offset + symbol_count * sizeof(image_symbol);
+  for (uint32_t addr = 0; addr < CELLS; addr++) {
+    if (meta[addr]) {
+      name += strlen(meta[addr]) + 1;
+    }
+  }
+  symbols->size = name - offset;
+
+  FILE *img = fopen(argv[2], "wb");
+  if (!img) {
+    perror(argv[2]);
+    return (1);
+  }
+  fwrite(&header, sizeof(header), 1, img);
+  for (int idx = IMAGE_CODE; idx <= IMAGE_DICT; idx++) {
+    fwrite(&memory[header.sections[idx].base], sizeof(uint16_t),
+           header.sections[idx].count, img);
+  }
+  name = offset + symbol_count * sizeof(image_symbol);
+  for (uint32_t addr = 0; addr < CELLS; addr++) {
+    if (meta[addr]) {
+      image_symbol symbol = {addr, name};
+      fwrite(&symbol, sizeof(symbol), 1, img);
+      name += strlen(meta[addr]) + 1;
+    }
+  }
+  for (uint32_t addr = 0; addr < CELLS; addr++) {
+    if (meta[addr]) {
+      fwrite(meta[addr], strlen(meta[addr]) + 1, 1, img);
+    }
+  }
+  if (fclose(img) != 0) {
+    perror(argv[2]);
+    return (1);
+  }
+  printf("%s: CODE=%u DATA=%u DICT=%u cells, %u symbols\n", argv[2],
+         header.sections[IMAGE_CODE].count, header.sections[IMAGE_DATA].count,
+         header.sections[IMAGE_DICT].count, symbol_count);
+  return (0);
+}
@@ -0,0 +1,322 @@
+//
+// server.c - a REPL server on a Unix domain socket.
+//
+// Usage: hexaforth-server <image.img> <socket> [threads]
+//
+// Boots the nucleus once, until `quit` first waits for input, and
+// snapshots it there.  Each connection gets its own clone of that
+// snapshot, reading from and writing to the socket, so a session costs the
+// pages it writes to and starts without booting.  A few event loop threads
+// share the sessions: each runs its sessions in `SESSION_SLICE` cycle
+// slices, round robin, and leaves a session that is waiting for input in
+// its epoll set until the socket is readable.  A session ends when its
+// VM halts, normally by reaching the end of its input.
+//
+// Output never blocks a thread.  What the socket won't take is kept with
+// the session, at most what one slice wrote, and the session sits out
+// until epoll reports the socket writable and the backlog has gone.
+//
+// HEXAFORTH_ENGINE picks the engine, as for hexaforth.  Beyond the pages
+// it writes, a session on the switch, threaded, generated or stackcache
+// engine costs nothing per engine; predecoded and fused build a 1MB side
+// table each as soon as they run, and jit reserves a 4MB code arena and a
+// 512KB block table each, committed as code is compiled.
+//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../vm.h"
+
+// Cycles a session runs before the others on its thread get a turn.
+#define SESSION_SLICE 100000
+#define SERVER_THREADS 4
+#define SERVER_EVENTS 64
+
+struct session;
+
+struct worker {
+    pthread_t          thread;
+    int                epoll;
+    struct session     *head;       // run queue
+    struct session     *tail;
+};
+
+struct session {
+    context            *ctx;
+    int                fd;
+    int                status;      // of the last slice
+    bool               queued;      // on its worker's run queue
+    bool               draining;    // waiting for the socket to take output
+    bool               broken;      // the socket failed; drop output
+    char               *pending;    // output the socket hasn't taken yet
+    size_t             pending_from;
+    size_t             pending_len;
+    size_t             pending_size;
+    struct session     *next;
+};
+
+// Send what the socket will take of the backlog.  True once nothing is
+// left to send, or the socket has failed.
+static bool session_drain(struct session *session) {
+    while (session->pending_from < session->pending_len) {
+        ssize_t sent = send(session->fd,
+                            session->pending + session->pending_from,
+                            session->pending_len - session->pending_from,
+                            MSG_NOSIGNAL);
+        if (sent >= 0) {
+            session->pending_from += sent;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        } else if (errno != EINTR) {
+            session->broken = true;
+            break;
+        }
+    }
+    session->pending_from = session->pending_len = 0;
+    return true;
+}
+
+// `OUT` of a session: takes the whole buffer, sending what the socket
+// takes now and keeping the rest for `session_drain()`.
+static ssize_t session_write(void *cookie, const char *buf, size_t size) {
+    struct session *session = cookie;
+    if (session->broken) {
+        return size;
+    }
+    size_t done = 0;
+    while (!session->pending_len && done < size) {
+        ssize_t sent = send(session->fd, buf + done, size - done,
+                            MSG_NOSIGNAL);
+        if (sent >= 0) {
+            done += sent;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            session->broken = true;
+            return size;
+        }
+    }
+    size_t left = size - done;
+    if (left > session->pending_size - session->pending_len) {
+        size_t grown = session->pending_size ? session->pending_size : 4096;
+        while (grown < session->pending_len + left) {
+            grown *= 2;
+        }
+        char *pending = realloc(session->pending, grown);
+        if (!pending) {
+            session->broken = true;
+            return size;
+        }
+        session->pending = pending;
+        session->pending_size = grown;
+    }
+    memcpy(session->pending + session->pending_len, buf + done, left);
+    session->pending_len += left;
+    return size;
+}
+
+// Wait on the socket for `events`, readable or writable.
+static void session_watch(struct worker *worker, struct session *session,
+                          uint32_t events) {
+    struct epoll_event event = {.events = events | EPOLLRDHUP,
+                                .data.ptr = session};
+    epoll_ctl(worker->epoll, EPOLL_CTL_MOD, session->fd, &event);
+}
+
+static void session_queue(struct worker *worker, struct session *session) {
+    session->queued = true;
+    session->next = NULL;
+    if (worker->tail) {
+        worker->tail->next = session;
+    } else {
+        worker->head = session;
+    }
+    worker->tail = session;
+}
+
+// Clone a session for the non-blocking socket `fd` and hand it to `worker`.
+static void session_open(struct vm_snapshot *snap, int fd,
+                         struct worker *worker) {
+    struct session *session = calloc(1, sizeof(struct session));
+    context *ctx = session ? vm_clone(snap) : NULL;
+    if (!ctx) {
+        free(session);
+        close(fd);
+        return;
+    }
+    session->ctx = ctx;
+    session->fd = fd;
+    ctx->IN = fdopen(fd, "r");
+    ctx->OUT = fopencookie(session, "w", (cookie_io_functions_t){
+            .write = session_write});
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP,
+                                .data.ptr = session};
+    if (!ctx->IN || !ctx->OUT ||
+        epoll_ctl(worker->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+        if (ctx->OUT) fclose(ctx->OUT);
+        if (ctx->IN) fclose(ctx->IN); else close(fd);
+        vm_clone_release(ctx);
+        free(session);
+    }
+}
+
+static void session_close(struct worker *worker, struct session *session) {
+    epoll_ctl(worker->epoll, EPOLL_CTL_DEL, session->fd, NULL);
+    fclose(session->ctx->OUT);
+    fclose(session->ctx->IN);
+    vm_clone_release(session->ctx);
+    free(session->pending);
+    free(session);
+}
+
+// Act on how the last slice ended, once its output has gone: run again,
+// wait for input, or end.
+static void session_settle(struct worker *worker, struct session *session) {
+    if (session->broken ||
+        (session->status != VM_PREEMPTED && session->status != VM_BLOCKED)) {
+        session_close(worker, session);
+    } else if (session->status == VM_PREEMPTED) {
+        session_queue(worker, session);
+    }
+}
+
+// Run the sessions that are ready, a slice each, until none are, then
+// wait for more.  A session that used up its slice goes to the back of the
+// queue; one that blocked waits for its socket again, as does one whose
+// output the socket hasn't taken yet.
+static void* worker_run(void *arg) {
+    struct worker *worker = arg;
+    struct epoll_event events[SERVER_EVENTS];
+    for (;;) {
+        int ready = epoll_wait(worker->epoll, events, SERVER_EVENTS,
+                               worker->head ? 0 : -1);
+        for (int idx = 0; idx < ready; idx++) {
+            struct session *session = events[idx].data.ptr;
+            if (session->draining) {
+                if (session_drain(session)) {
+                    session->draining = false;
+                    session_watch(worker, session, EPOLLIN);
+                    session_settle(worker, session);
+                }
+            } else if (!session->queued) {
+                session_queue(worker, session);
+            }
+        }
+        struct session *round = worker->head;
+        worker->head = worker->tail = NULL;
+        while (round) {
+            struct session *session = round;
+            round = session->next;
+            session->queued = false;
+            session->status = vm_run(session->ctx, SESSION_SLICE);
+            if (!session->broken && !session_drain(session)) {
+                session->draining = true;
+                session_watch(worker, session, EPOLLOUT);
+                continue;
+            }
+            session_settle(worker, session);
+        }
+    }
+    return NULL;
+}
+
+// Run the image until it first waits for input, reading from a pipe that
+// stays empty and throwing its output away, and snapshot it there.
+static struct vm_snapshot* boot(const char *path) {
+    context *ctx = vm_new();
+    int fds[2];
+    if (!ctx || !vm_image_load(ctx, path) || pipe(fds) != 0) {
+        fprintf(stderr, "Can't load image '%s'\n", path);
+        return NULL;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    ctx->words = FORTH_WORDS;
+    init_opcodes(ctx->words);
+    ctx->IN = fdopen(fds[0], "r");
+    ctx->OUT = NULL;
+    char* engine = getenv("HEXAFORTH_ENGINE");
+    if (engine) {
+        int selected = vm_engine_lookup(engine);
+        if (selected < 0) {
+            fprintf(stderr, "Unknown HEXAFORTH_ENGINE '%s'\n", engine);
+            return NULL;
+        }
+        ctx->engine = selected;
+    }
+    if (ctx->engine == ENGINE_PREDECODED || ctx->engine == ENGINE_FUSED) {
+        vm_predecode(ctx);
+    }
+    int status = vm(ctx);
+    struct vm_snapshot *snap = status == VM_BLOCKED ? vm_snapshot(ctx) : NULL;
+    if (status != VM_BLOCKED) {
+        fprintf(stderr, "'%s' didn't wait for input (status %d)\n", path,
+                status);
+    }
+    fclose(ctx->IN);
+    close(fds[1]);
+    vm_release(ctx);
+    free(ctx);
+    return snap;
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        perror(path);
+        return -1;
+    }
+    return listener;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <image.img> <socket> [threads]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    int threads = argc > 3 ? atoi(argv[3]) : SERVER_THREADS;
+    if (threads < 1) threads = 1;
+    struct vm_snapshot *snap = boot(argv[1]);
+    int listener = snap ? listen_unix(argv[2]) : -1;
+    if (listener < 0) {
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    struct worker *workers = calloc(threads, sizeof(struct worker));
+    for (int idx = 0; idx < threads; idx++) {
+        workers[idx].epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (workers[idx].epoll < 0 ||
+            pthread_create(&workers[idx].thread, NULL, worker_run,
+                           &workers[idx]) != 0) {
+            perror("worker");
+            return EXIT_FAILURE;
+        }
+    }
+    for (uint64_t next = 0; ; ) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) perror("accept");
+            continue;
+        }
+        session_open(snap, fd, &workers[next++ % threads]);
+    }
+}
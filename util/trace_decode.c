@@ -0,0 +1,86 @@
+//
+// trace_decode.c - renders a binary trace ring as text.
+//
+// Usage: hexaforth-trace <ring file> [last]
+//
+// Prints the records in a file written by `vm_trace_ring_open()`, oldest
+// first, or only the `last` ones.  Each line carries the same disassembly
+// as `print_state()`, from `debug_address()` with the symbols saved in the
+// file, followed by the registers the record holds.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../vm.h"
+#include "../vm_debug.h"
+#include "../vm_opcodes.h"
+#include "../vm_trace_ring.h"
+
+static void load_symbols(FILE *file, uint64_t offset, context *ctx) {
+  char line[128];
+  fseek(file, offset, SEEK_SET);
+  while (fgets(line, sizeof(line), file)) {
+    unsigned int addr;
+    char name[100];
+    if (sscanf(line, "%x %99s", &addr, name) == 2 &&
+        addr < VM_META_CELLS && vm_meta(ctx)) {
+      ctx->meta[addr] = strdup(name);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <ring file> [last]\n", argv[0]);
+    return (1);
+  }
+  FILE *file = fopen(argv[1], "rb");
+  if (!file) {
+    perror(argv[1]);
+    return (1);
+  }
+  trace_ring_header header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, TRACE_RING_MAGIC, sizeof(header.magic)) != 0 ||
+      !header.capacity || (header.capacity & (header.capacity - 1))) {
+    fprintf(stderr, "%s: not a trace ring\n", argv[1]);
+    return (1);
+  }
+  trace_record *records = malloc(header.capacity * sizeof(trace_record));
+  if (!records || fread(records, sizeof(trace_record), header.capacity,
+                        file) != header.capacity) {
+    fprintf(stderr, "%s: truncated trace ring\n", argv[1]);
+    return (1);
+  }
+
+  context *ctx = vm_new();
+  ctx->words = FORTH_WORDS;
+  init_opcodes(ctx->words);
+  load_symbols(file, header.symbols, ctx);
+  fclose(file);
+
+  uint64_t first = header.written > header.capacity
+                       ? header.written - header.capacity
+                       : 0;
+  if (argc > 2) {
+    uint64_t last = strtoull(argv[2], NULL, 0);
+    if (header.written - first > last) {
+      first = header.written - last;
+    }
+  }
+  printf("%llu instructions recorded, %llu kept\n",
+         (unsigned long long)header.written,
+         (unsigned long long)(header.written - first));
+  for (uint64_t idx = first; idx < header.written; idx++) {
+    trace_record *record = &records[idx & (header.capacity - 1)];
+    char disasm[160];
+    ctx->memory[record->EIP] = record->raw;
+    debug_address(disasm, ctx, record->EIP);
+    printf("%12llu EXEC[0x%0.4x]: %s S[%d] T=%lld R[%d] R=%lld\n",
+           (unsigned long long)record->cycle, record->EIP, disasm, record->SP,
+           (long long)record->T, record->RSP, (long long)record->R);
+  }
+  free(records);
+  return (0);
+}
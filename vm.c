@@ -2,16 +2,19 @@
 // Created by Wes Brown on 12/31/20.
 //
 
+#include <errno.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "vm.h"
 #include "vm_instruction.h"
 #include "vm_constants.h"
 #include "util/stack.h"
-#ifdef DEBUG
 #include "vm_debug.h"
 #include "vm_opcodes.h"
-#endif // DEBUG
+#include "vm_trace_ring.h"
 
 static inline uint8_t clz(uint64_t N) {
     return N ? 64 - __builtin_clzll(N) : -(uint64_t)INFINITY;
@@ -21,39 +24,163 @@ static inline uint8_t ctz(uint64_t N) {
     return N ? 64 - __builtin_ctzll(N) : -(uint64_t)INFINITY;
 }
 
-static inline int64_t io_write_handler(context *ctx, uint64_t io_addr, int64_t io_write) {
+// Hand the bytes buffered in `ctx` to `OUT`.
+static void vm_out_drain(context *ctx) {
+    if (ctx->OUT_LEN && ctx->OUT) {
+        fwrite(ctx->OUT_BUF, 1, ctx->OUT_LEN, ctx->OUT);
+    }
+    ctx->OUT_LEN = 0;
+}
+
+// Write `len` bytes to `ctx->OUT` through the context's buffer.
+void vm_out(context *ctx, const void *bytes, uint64_t len) {
+    if (len > VM_OUT_BYTES - ctx->OUT_LEN) {
+        vm_out_drain(ctx);
+    }
+    if (len >= VM_OUT_BYTES) {
+        if (ctx->OUT) fwrite(bytes, 1, len, ctx->OUT);
+        return;
+    }
+    memcpy(ctx->OUT_BUF + ctx->OUT_LEN, bytes, len);
+    ctx->OUT_LEN += len;
+    if (memchr(bytes, '\n', len)) {
+        vm_out_drain(ctx);
+    }
+}
+
+// Hand over everything buffered and flush `ctx->OUT`.
+void vm_out_flush(context *ctx) {
+    vm_out_drain(ctx);
+    if (ctx->OUT) fflush(ctx->OUT);
+}
+
+// The console device, on ports 0xe0-0xe3 and 0xf0-0xf3 unless the host
+// attaches others there.  io 0xf1 writes a byte, 0xf0 the bytes of a cell,
+// and 0xf2 the given number of bytes from the address last written to 0xf3.
+// A block that isn't wholly inside memory is not written.  0xe1 and 0xe2
+// set the address and size of the buffer io 0xe2 reads lines into.
+int64_t vm_console_write(context *ctx, uint64_t io_addr, int64_t io_write,
+                         void *data) {
     switch (io_addr) {
-        case 0xf1:
-            fputc((uint8_t)io_write, ctx->OUT);
+        case 0xf1: {
+            uint8_t byte = io_write;
+            vm_out(ctx, &byte, 1);
             return(TRUE);
+        }
         case 0xf0: {
             uint8_t msb = clz(io_write) + 1;
             uint8_t num_bytes = (msb / 8 + (msb % 8 ? 1 : 0));
             for(uint8_t idx=0; idx<num_bytes; idx++) {
                 io_write = io_write << idx*8;
-                fputc((uint8_t)io_write, ctx->OUT);
+                uint8_t byte = io_write;
+                vm_out(ctx, &byte, 1);
+            }
+            return(TRUE);
+        }
+        case 0xf2: {
+            uint64_t len = io_write;
+            if (ctx->OUT_ADDR > ctx->MEMORY_BYTES ||
+                len > ctx->MEMORY_BYTES - ctx->OUT_ADDR) {
+                return(FALSE);
             }
+            vm_out(ctx, (uint8_t*)ctx->memory + ctx->OUT_ADDR, len);
             return(TRUE);
         }
+        case 0xf3:
+            ctx->OUT_ADDR = io_write;
+            return(TRUE);
+        case 0xe1:
+            ctx->IN_ADDR = io_write;
+            return(TRUE);
+        case 0xe2:
+            ctx->IN_MAX = io_write;
+            return(TRUE);
         case 0xe0: {
-            print_stack(ctx->SP-2, ctx->DSTACK[ctx->SP-3], ctx, false);
-            print_stack(ctx->RSP-1, ctx->RSTACK[ctx->RSP-2], ctx, true);
+            vm_out_flush(ctx);
+            // Only read the stacks down to their parking cells.
+            print_stack(ctx->SP-2, ctx->SP >= 2 ? ctx->DSTACK[ctx->SP-3] : 0,
+                        ctx, false);
+            print_stack(ctx->RSP-1, ctx->RSP >= 1 ? ctx->RSTACK[ctx->RSP-2] : 0,
+                        ctx, true);
         }
         default:
             return(FALSE);
     }
 }
 
-static inline int64_t io_read_handler(context *ctx, uint64_t io_addr) {
+// Did a read from `ctx->IN` stop because a non-blocking descriptor had
+// nothing for it?  If so, it can be read again once it's ready.
+static bool in_would_block(context *ctx) {
+    if (!ferror(ctx->IN) || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        return false;
+    }
+    clearerr(ctx->IN);
+    return true;
+}
+
+// Read a line from `ctx->IN` into the `IN_MAX` bytes at `IN_ADDR`, for io
+// 0xe2.  Tabs become spaces and other control characters are dropped, as
+// `accept` does, and whatever doesn't fit is read and thrown away.  Returns
+// the bytes stored, or -1 at the end of input.  A line that would block
+// part way is carried on with by the next read.  Like the bulk writes in
+// vm_memory.c, it tells the engines and the dictionary index what it
+// overwrote.
+static int64_t vm_in_line(context *ctx) {
+    if (ctx->IN_ADDR > ctx->MEMORY_BYTES ||
+        ctx->IN_MAX > ctx->MEMORY_BYTES - ctx->IN_ADDR) {
+        return -1;
+    }
+    uint8_t *line = (uint8_t*)ctx->memory + ctx->IN_ADDR;
+    int64_t len = ctx->IN_PART;
+    bool any = len > 0;
+    int c;
+    flockfile(ctx->IN);
+    while ((c = getc_unlocked(ctx->IN)) != EOF) {
+        any = true;
+        if (c == '\n') break;
+        if (c == '\t') c = ' ';
+        if (c < ' ' || c == 0x7f) continue;
+        if ((uint64_t)len < ctx->IN_MAX) line[len++] = c;
+    }
+    bool blocked = c == EOF && in_would_block(ctx);
+    funlockfile(ctx->IN);
+    uint64_t end = (ctx->IN_ADDR + len + 1) >> 1;
+    if (len && ctx->IN_ADDR >> 1 < VM_CODE_CELLS) {
+        if (end > VM_CODE_CELLS) end = VM_CODE_CELLS;
+        vm_invalidate_code(ctx, ctx->IN_ADDR >> 1,
+                           end - (ctx->IN_ADDR >> 1));
+        vm_dict_invalidate(ctx, ctx->IN_ADDR, len);
+    }
+    ctx->IN_PART = blocked ? len : 0;
+    if (blocked) {
+        return vm_io_block(ctx, fileno(ctx->IN));
+    }
+    return any ? len : -1;
+}
+
+// io 0xe0 reads a byte, 0xe2 a line, see `vm_in_line()`, and 0xe3 is true
+// when input is a terminal.
+int64_t vm_console_read(context *ctx, uint64_t io_addr, void *data) {
     switch (io_addr) {
-        case 0xe0:
-            return(fgetc(ctx->IN));
+        case 0xe0: {
+            vm_out_flush(ctx);
+            int c = fgetc(ctx->IN);
+            if (c == EOF && in_would_block(ctx)) {
+                return(vm_io_block(ctx, fileno(ctx->IN)));
+            }
+            return(c);
+        }
+        case 0xe2:
+            vm_out_flush(ctx);
+            return(vm_in_line(ctx));
+        case 0xe3:
+            return(isatty(fileno(ctx->IN)) ? TRUE : FALSE);
         default:
             return(false);
     }
 }
 
-#ifdef DEBUG
+// One trace line, to `ctx->trace` when tracing is on and stderr otherwise.
 void print_state(context *ctx, int16_t RSP, int16_t SP, int16_t EIP, int16_t R, int16_t T) {
     char disasm[160];
     char rstack_repr[80];
@@ -61,29 +188,62 @@ void print_state(context *ctx, int16_t RSP, int16_t SP, int16_t EIP, int16_t R,
     mini_stack(RSP, R, ctx->RSTACK, rstack_repr);
     mini_stack(SP, T, ctx->DSTACK, dstack_repr);
     debug_address(disasm, ctx, EIP);
-    dprintf("EXEC[0x%0.4x]: %s S%-26s R%s\n", EIP, disasm, dstack_repr, rstack_repr);
+    fprintf(ctx->trace ? ctx->trace : stderr,
+            "EXEC[0x%0.4x]: %s S%-26s R%s\n",
+            EIP, disasm, dstack_repr, rstack_repr);
 }
-#endif
 
-int vm(context *ctx) {
+// DEBUG builds trace every engine unconditionally; otherwise only the
+// `traced` copy of the switch loop does.
+#ifdef DEBUG
+#define TRACING(traced) true
+#else
+#define TRACING(traced) (traced)
+#endif // DEBUG
+
+// A taken branch, call or return can end a budgeted run.  `cycles` does
+// not count the current instruction yet.
+#define BUDGET_CHECK() do {                         \
+        if (cycles + 1 >= limit) {                  \
+            cycles++;                               \
+            status = VM_PREEMPTED;                  \
+            goto done;                              \
+        }                                           \
+    } while (0)
+
+// The switch loop, inlined twice: `traced` is a constant in each copy, so
+// `vm_switch()` carries no trace code at all and `vm_traced()` prints every
+// instruction.
+static inline __attribute__((always_inline))
+int vm_switch_loop(context *ctx, const bool traced) {
     register int16_t EIP = ctx->EIP;        // EIP = execution pointer
-    register int16_t SP = 0;                // SP = data stack pointer
-    register int16_t RSP = 0;               // RSP = return stack pointer
-    register int64_t T = ctx->DSTACK[SP];   // T = Top Of Stack / TOS
-    register int64_t R = ctx->RSTACK[RSP];  // R = Top Of Return Stack / TOR
+    register int16_t SP = ctx->SP;          // SP = data stack pointer
+    register int16_t RSP = ctx->RSP;        // RSP = return stack pointer
+    register int64_t T = DLOAD(SP-1);       // T = Top Of Stack / TOS
+    register int64_t R = ctx->RSTACK[RSP-1]; // R = Top Of Return Stack / TOR
     register int64_t IN = 0;                // I = input to ALU
     register int64_t N;                     // N = Next on Stack / NOS
     register int64_t OUT = 0;               // OUT - result from ALU
     register uint64_t cycles = ctx->CYCLES; // how many instructions processed
+    uint64_t limit = ctx->CYCLE_LIMIT;      // stop at a branch past this
+    int status = VM_HALTED;
 
     for (; ctx->memory[EIP] != 0; ++cycles) {
         // #ifdef DEBUG
         //    show_registers(T, R, EIP, SP, RSP, ctx);
         // #endif // DEBUG
         instruction ins = *(instruction*)&(ctx->memory[EIP]);
-        #ifdef DEBUG
-        print_state(ctx, RSP, SP, EIP, R, T);
-        #endif // DEBUG
+        if (TRACING(traced)) {
+            if (ctx->ring) {
+                vm_trace_ring_record(ctx->ring, cycles, EIP,
+                                     ctx->memory[EIP], SP, RSP, T, R);
+            } else {
+                print_state(ctx, RSP, SP, EIP, R, T);
+            }
+        }
+        #ifdef VM_PROFILE
+        vm_profile_record(ctx, ctx->memory[EIP]);
+        #endif // VM_PROFILE
         // increment EIP to the next instruction for next cycle
         EIP++;
         // == MSB set is an instruction literal.
@@ -91,7 +251,7 @@ int vm(context *ctx) {
             int64_t lit = (uint64_t)ins.lit.lit_v <<
                               (ins.lit.lit_shifts * LIT_BITS);
             if (!ins.lit.lit_add) {
-                ctx->DSTACK[SP-1] = T;
+                DSTORE(SP-1, T);
                 SP++;
                 T = (int64_t)lit;
             } else {
@@ -104,15 +264,17 @@ int vm(context *ctx) {
                 // Conditional jump - jumps if TOS is zero (0branch)
                 SP--;
                 bool RES=(uint64_t)T;
-                T=ctx->DSTACK[SP-1];
+                T=DLOAD(SP-1);
                 if (!RES) {
                     EIP = ins.jmp.target;
+                    BUDGET_CHECK();
                 }
                 break;
             }
             case OP_TYPE_JMP:
                 // Unconditional jump
                 EIP = ins.jmp.target;
+                BUDGET_CHECK();
                 break;
             case OP_TYPE_CALL:
                 // Unconditional call
@@ -121,9 +283,10 @@ int vm(context *ctx) {
                 ctx->RSTACK[RSP] = EIP;
                 RSP++;
                 EIP = ins.jmp.target;
+                BUDGET_CHECK();
                 break;
             case OP_TYPE_ALU: {
-                N = ctx->DSTACK[SP-2];
+                N = DLOAD(SP-2);
                 switch (ins.alu.in_mux) {
                     // Pick which data source for our input `I`:
                     case INPUT_N:
@@ -157,13 +320,13 @@ int vm(context *ctx) {
                         break;
                     case ALU_T_N:
                         // `T->N, IN->OUT`
-                        ctx->DSTACK[SP - 2] = T;
+                        DSTORE(SP - 2, T);
                         OUT = IN;
                         break;
                     case ALU_SWAP_IN:
                         // 'T<->N, IN->OUT'
-                        OUT = ctx->DSTACK[SP - 2];
-                        ctx->DSTACK[SP - 2] = T;
+                        OUT = DLOAD(SP - 2);
+                        DSTORE(SP - 2, T);
                         T = OUT;
                         OUT = IN;
                         break;
@@ -196,6 +359,13 @@ int vm(context *ctx) {
                         OUT = (uint64_t) IN >> T;
                         break;
                     case ALU_LSHIFT:
+                        // `T->IN IN<<T` is an extended op, see `INS_EXT()`.
+                        if (INS_EXT(ins)) {
+                            DSTORE(SP - 1, T);
+                            SP = vm_ext(ctx, INS_EXT_OP(ins), SP);
+                            T = DLOAD(SP - 1);
+                            continue;
+                        }
                         // `(IN<<T)->OUT`
                         OUT = (uint64_t) IN << T;
                         break;
@@ -204,6 +374,22 @@ int vm(context *ctx) {
                         OUT = IN * N;
                         break;
                     case ALU_LOAD: {
+                        // `T->IN [IN]` with a width, see `INS_NARROW()`.
+                        if (INS_NARROW(ins)) {
+                            SP += ins.alu.dstack;
+                            if (ins.alu.dstack > 0) {
+                                DSTORE(SP - 2, T);
+                            }
+                            if (ins.alu.out_mux != OUTPUT_MEM_T) {
+                                T = vm_load_narrow(ctx, T, INS_WIDTH(ins));
+                            } else {
+                                vm_store_narrow(ctx, T, N, INS_WIDTH(ins));
+                                if (ins.alu.dstack < 0) {
+                                    T = DLOAD(SP - 1);
+                                }
+                            }
+                            continue;
+                        }
                         OUT = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+IN);
                         break;
                     }
@@ -226,7 +412,7 @@ int vm(context *ctx) {
                 RSP += ins.alu.rstack;
                 // Update NOS (Next On Stack) if stack size was incremented
                 if (ins.alu.dstack > 0) {
-                    ctx->DSTACK[SP - 2] = T;
+                    DSTORE(SP - 2, T);
                 }
                 if (ins.alu.rstack > 0) {
                     ctx->RSTACK[RSP - 2] = R;
@@ -241,7 +427,7 @@ int vm(context *ctx) {
                     case OUTPUT_R:
                         R = OUT;
                         if (ins.alu.dstack < 0) {
-                            T = ctx->DSTACK[SP - 1];
+                            T = DLOAD(SP - 1);
                         }
                         break;
                     // `OUT->io[T]` IO write op.
@@ -257,7 +443,7 @@ int vm(context *ctx) {
                     default:
                     resolve_dstack:
                         if (ins.alu.dstack < 0) {
-                            T = ctx->DSTACK[SP -1];
+                            T = DLOAD(SP -1);
                         }
                     resolve_rstack:
                         if (ins.alu.rstack < 0) {
@@ -265,6 +451,9 @@ int vm(context *ctx) {
                         }
                         break;
                 }
+                if (ins.alu.r_eip) {
+                    BUDGET_CHECK();
+                }
                 break;
             }
             // This should never happen.
@@ -273,15 +462,163 @@ int vm(context *ctx) {
         }
         // print_stack(SP,T, ctx, false);
     }
-#ifdef DEBUG
-    print_state(ctx, RSP, SP, EIP, R, T);
-#endif
+done:
+    if (TRACING(traced) && !ctx->ring) {
+        print_state(ctx, RSP, SP, EIP, R, T);
+    }
     ctx->CYCLES = cycles;
-    ctx->DSTACK[SP-1] = T;
+    DSTORE(SP-1, T);
     ctx->RSTACK[RSP-1] = R;
     ctx->SP = SP;
     ctx->RSP = RSP;
     ctx->EIP = EIP;
-    fflush(ctx->OUT);
-    return 1;
-}
\ No newline at end of file
+    vm_out_flush(ctx);
+    return status;
+}
+
+int vm_switch(context *ctx) {
+    return vm_switch_loop(ctx, false);
+}
+
+int vm_traced(context *ctx) {
+    return vm_switch_loop(ctx, true);
+}
+
+// Given an engine name from `VM_ENGINE_REPR[]`, return its `VM_ENGINE`
+// value, or -1 if there is no such engine.
+int vm_engine_lookup(const char* name) {
+    for (int engine = 0; engine < VM_ENGINE_COUNT; engine++) {
+        if (strcmp(VM_ENGINE_REPR[engine], name) == 0) {
+            return engine;
+        }
+    }
+    return -1;
+}
+
+// Run `ctx` with the engine selected by `ctx->engine`, or with the traced
+// switch loop while `ctx->trace` or `ctx->ring` is set.  Every engine
+// observes and leaves the same `context` state.
+static int vm_engine_dispatch(context *ctx) {
+    if (ctx->trace || ctx->ring) {
+        return vm_traced(ctx);
+    }
+    switch (ctx->engine) {
+        case ENGINE_THREADED:
+            return vm_threaded(ctx);
+        case ENGINE_PREDECODED:
+        case ENGINE_FUSED:
+            return vm_predecoded(ctx);
+        case ENGINE_GENERATED:
+            return vm_generated(ctx);
+        case ENGINE_JIT:
+            return vm_jit(ctx);
+        case ENGINE_STACKCACHE:
+            return vm_stackcache(ctx);
+        case ENGINE_SWITCH:
+        default:
+            return vm_switch(ctx);
+    }
+}
+
+// Run `ctx` with its stacks guarded, giving it default stacks if it has
+// none yet.
+static int vm_engine_run(context *ctx) {
+    if (!ctx->DSTACK && !vm_stacks(ctx, VM_STACK_CELLS, VM_STACK_CELLS)) {
+        return VM_STACK_OVERFLOW;
+    }
+    if (ctx->BLOCKED && !ctx->memory[ctx->EIP]) {
+        // Step over the `pause` it halted on.  A run preempted between the
+        // read and the `pause` stays blocked and carries on where it was.
+        ctx->BLOCKED = false;
+        ctx->EIP++;
+    }
+    int status = vm_stacks_guard(ctx, vm_engine_dispatch);
+    if (status > VM_HALTED) {
+        // A trapped engine never reached its own flush.
+        vm_out_flush(ctx);
+    }
+    return status == VM_HALTED && ctx->BLOCKED ? VM_BLOCKED : status;
+}
+
+// A zeroed context on its own cache lines, with `VM_MEMORY_BYTES` of
+// memory; free it with `free()` after `vm_release()`.  Returns NULL if
+// there's no memory for it.
+context* vm_new(void) {
+    void *ctx = NULL;
+    if (posix_memalign(&ctx, 64, sizeof(context)) != 0) {
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(context));
+    if (!vm_memory(ctx, VM_MEMORY_BYTES, 0)) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+// The symbol table of `ctx`, allocated on first use.  Contexts running
+// the same image can share one by copying the pointer; `vm_release()`
+// leaves it alone.
+char** vm_meta(context *ctx) {
+    if (!ctx->meta) {
+        ctx->meta = calloc(VM_META_CELLS, sizeof(char*));
+    }
+    return ctx->meta;
+}
+
+// Run `ctx` from `ctx->EIP` with empty stacks until it fetches a zero word.
+int vm(context *ctx) {
+    ctx->SP = 0;
+    ctx->RSP = 0;
+    ctx->CYCLE_LIMIT = UINT64_MAX;
+    return vm_engine_run(ctx);
+}
+
+// Resume `ctx` where the last `vm_run()` left it, for about `max_cycles`
+// more instructions.  Engines only check the budget at taken branches,
+// calls and returns (the JIT and generated engines between blocks and
+// instructions), so a run may overshoot by a straight-line stretch of
+// code; the computed-goto engines stop in front of a return rather than
+// after it.  Every call runs at least one instruction, so a context run
+// in slices of any size makes progress.  Returns `VM_PREEMPTED` if the
+// budget ran out, or `VM_BLOCKED` if it is waiting for `ctx->WAIT_FD`,
+// with the context ready for the next call, or `VM_HALTED`.
+int vm_run(context *ctx, uint64_t max_cycles) {
+    if (!max_cycles) {
+        max_cycles = 1;
+    }
+    ctx->CYCLE_LIMIT = max_cycles > UINT64_MAX - ctx->CYCLES ?
+                       UINT64_MAX : ctx->CYCLES + max_cycles;
+    return vm_engine_run(ctx);
+}
+
+// Trace every instruction `ctx` runs to `out` as text, or stop tracing if
+// `out` is NULL.  A ring from `vm_trace_ring_open()` takes precedence.
+// Engines keep their own copy of the context state while they run, so a
+// change made from an io handler takes effect at the next `vm_run()`
+// slice; a run sliced with `vm_run()` can switch tracing between slices.
+void vm_trace(context *ctx, FILE *out) {
+    ctx->trace = out;
+}
+
+// Tell the engines that keep translated code that `count` cells starting
+// at `addr` were rewritten from outside the VM.  A host rewriting headers
+// tells the dictionary index with `vm_dict_invalidate()`.
+void vm_invalidate_code(context *ctx, uint32_t addr, uint32_t count) {
+    vm_predecode_invalidate(ctx, addr, count);
+    vm_jit_invalidate(ctx, addr, count);
+}
+
+// Free the memory, stacks and side tables of `ctx`, but not `ctx` itself.
+void vm_release(context *ctx) {
+    free(ctx->decoded);
+    ctx->decoded = NULL;
+    free(ctx->profile);
+    ctx->profile = NULL;
+    vm_dict_release(ctx);
+    vm_io_release(ctx);
+    vm_trace_ring_close(ctx);
+    vm_stacks_release(ctx);
+    vm_memory_release(ctx);
+    vm_jit_release(ctx);
+}
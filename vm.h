@@ -9,27 +9,316 @@
 #include <stdio.h>
 #include "vm_opcodes.h"
 
-typedef struct { int EIP;
-    int        HERE;
+// === VM_ENGINE: which execution loop `vm()` runs a context with.
+enum VM_ENGINE {
+    ENGINE_SWITCH = 0,     // nested `switch` decode per instruction field
+    ENGINE_THREADED = 1,   // computed goto, dispatch replicated per handler
+    ENGINE_PREDECODED = 2, // computed goto over a pre-decoded side array
+    ENGINE_GENERATED = 3,  // call through the generated 64K handler table
+    ENGINE_JIT = 4,        // x86-64 basic blocks, interpreting the rest
+    ENGINE_STACKCACHE = 5, // computed goto, up to N and the third item cached
+    ENGINE_FUSED = 6,      // predecoded, hot pairs fused into superinstructions
+    VM_ENGINE_COUNT
+};
+
+static char* VM_ENGINE_REPR[] = {
+        "switch", "threaded", "predecoded", "generated", "jit", "stackcache",
+        "fused"
+};
+
+// What an engine returns: it fetched a zero word, or it used up the
+// cycle budget given to `vm_run()` and can be resumed.  `vm()` and
+// `vm_run()` also return a trap when the run hit a stack's guard page, and
+// `VM_BLOCKED` when it paused to wait for input, see `vm_io_block()`.
+enum VM_STATUS {
+    VM_PREEMPTED = 0,
+    VM_HALTED = 1,
+    VM_STACK_OVERFLOW = 2,
+    VM_STACK_UNDERFLOW = 3,
+    VM_BLOCKED = 4
+};
+
+// Stack depth, in cells, of contexts that run without calling
+// `vm_stacks()`, and the most `vm_stacks()` allows.  Depths are rounded up
+// to fill whole pages.
+#define VM_STACK_CELLS 128
+#define VM_STACK_MAX_CELLS 16384
+
+// Cells below each stack that engines may read or write while it is
+// empty: T and N are loaded from DSTACK[SP-1] and DSTACK[SP-2] whether or
+// not they exist.
+#define VM_STACK_PARK 2
+
+// Data stack memory traffic, counted by the switch and stackcache engines
+// when built with VM_STATS.
+typedef struct {
+    uint64_t   dstack_loads;
+    uint64_t   dstack_stores;
+} vm_stats;
+
+#ifdef VM_STATS
+#define DLOAD(idx)          (ctx->stats.dstack_loads++, ctx->DSTACK[idx])
+#define DSTORE(idx, val)    (ctx->stats.dstack_stores++, ctx->DSTACK[idx] = (val))
+#else
+#define DLOAD(idx)          (ctx->DSTACK[idx])
+#define DSTORE(idx, val)    (ctx->DSTACK[idx] = (val))
+#endif // VM_STATS
+
+// Cells a jump or call can reach, and so the most code a context holds.
+// `vm_new()` gives a context exactly this much memory; `vm_memory()` maps
+// more, which `@` and `!` reach with their full 64-bit addresses.
+#define VM_CODE_CELLS 65536
+#define VM_MEMORY_BYTES (VM_CODE_CELLS * sizeof(uint16_t))
+
+// `vm_memory()` flags.  VM_MEMORY_HUGE backs memory with huge pages if the
+// system has any to spare, and asks for transparent ones otherwise.
+#define VM_MEMORY_HUGE 1
+
+// Bytes of output a context holds before handing them to `OUT`.  It hands
+// them over sooner at a newline, and flushes `OUT` before reading input and
+// when a run ends.
+#define VM_OUT_BYTES 4096
+
+// Cells of code that `meta` can name.
+#define VM_META_CELLS 32768
+
+#if defined(__GNUC__)
+#define VM_CACHE_ALIGNED __attribute__((aligned(64)))
+#else
+#define VM_CACHE_ALIGNED
+#endif // __GNUC__
+
+// The first cache line holds the registers and engine state every
+// dispatch touches.  Memory and the stacks are mapped separately, by
+// `vm_memory()` and `vm_stacks()`.  Symbols, io handles and engine side
+// tables are cold and sit after it, and `meta` is a separately allocated
+// table that contexts can share.
+typedef struct VM_CACHE_ALIGNED {
+    int        EIP;
     int        SP;
     int        RSP;
+    int        HERE;
     int        DBGP;
-    uint16_t   memory[65536];
-    int64_t    DSTACK_park;
-    int64_t    DSTACK[128];
-    int64_t    RSTACK_park;
-    int64_t    RSTACK[128];
-    int64_t    DBGSTACK_park;
-    int64_t    DBGSTACK[32];
+    uint8_t    engine;
+    uint64_t   CYCLES;
+    uint64_t   CYCLE_LIMIT;
+    int64_t    *DSTACK;         // preceded by `VM_STACK_PARK` parking cells
+    int64_t    *RSTACK;
+    uint16_t   *memory;         // `MEMORY_BYTES` long, code in the first 128K
+    uint64_t   MEMORY_BYTES VM_CACHE_ALIGNED;
+    struct predecoded* decoded;
+    struct jit_state*  jit;
+    struct vm_dict*    dict;
+    struct vm_io*      io;
+    uint32_t   DSTACK_DEPTH;    // cells, not counting the parking cells
+    uint32_t   RSTACK_DEPTH;
     FILE       *OUT;
     FILE       *IN;
-    char*      meta[32768];
+    uint64_t   OUT_ADDR;        // latched by io 0xf3 for io 0xf2
+    uint64_t   IN_ADDR;         // latched by io 0xe1 and 0xe2 for io 0xe2
+    uint64_t   IN_MAX;
+    uint64_t   IN_PART;         // bytes of a line read before it blocked
+    bool       BLOCKED;         // see `vm_io_block()`
+    int        WAIT_FD;
+    uint32_t   OUT_LEN;
+    uint8_t    OUT_BUF[VM_OUT_BYTES];
+    char**     meta;
     word_node* words;
-    uint64_t   CYCLES; } context;
+    FILE       *trace;
+    struct vm_trace_ring* ring;
+    struct vm_profile* profile;
+    vm_stats   stats;
+    int64_t    DBGSTACK_park;
+    int64_t    DBGSTACK[32]; } context;
+
+// A device attached with `vm_io_attach()`: `io@` on one of its ports calls
+// `read`, and `io!` calls `write`, each given the port and the device's
+// `data`.  A device without one of them reads as 0 and ignores writes.
+typedef int64_t (*vm_io_read)(context *ctx, uint64_t port, void *data);
+typedef int64_t (*vm_io_write)(context *ctx, uint64_t port, int64_t value,
+                               void *data);
+
+// What a read that would block returns to the VM, see `vm_io_block()`.
+#define VM_IO_WOULD_BLOCK -2
+
+// The bytes an `INS_NARROW()` instruction of `width` loads or stores at byte
+// address `addr`.
+static inline uint64_t vm_load_narrow(context *ctx, int64_t addr,
+                                      uint8_t width) {
+    uint8_t *at = (uint8_t*)ctx->memory + addr;
+    switch (width) {
+        case MEM_8: return *at;
+        case MEM_16: return *(uint16_t*)at;
+        case MEM_32: return *(uint32_t*)at;
+        default: return *(uint64_t*)at;
+    }
+}
+
+static inline void vm_store_narrow(context *ctx, int64_t addr, int64_t value,
+                                   uint8_t width) {
+    uint8_t *at = (uint8_t*)ctx->memory + addr;
+    switch (width) {
+        case MEM_8: *at = value; break;
+        case MEM_16: *(uint16_t*)at = value; break;
+        case MEM_32: *(uint32_t*)at = value; break;
+        default: *(int64_t*)at = value; break;
+    }
+}
 
 static inline uint8_t clz(uint64_t N);
-static inline int64_t io_write_handler(context *ctx, uint64_t io_addr, int64_t io_write);
-static inline int64_t io_read_handler(context *ctx, uint64_t io_addr);
+void vm_out(context *ctx, const void *bytes, uint64_t len);
+void vm_out_flush(context *ctx);
+int64_t vm_console_write(context *ctx, uint64_t io_addr, int64_t io_write,
+                         void *data);
+int64_t vm_console_read(context *ctx, uint64_t io_addr, void *data);
+bool vm_io_attach(context *ctx, uint64_t port, uint64_t count,
+                  vm_io_read read, vm_io_write write, void *data);
+void vm_io_release(context *ctx);
+int64_t vm_io_block(context *ctx, int fd);
+int64_t io_write_handler(context *ctx, uint64_t io_addr, int64_t io_write);
+int64_t io_read_handler(context *ctx, uint64_t io_addr);
+void print_state(context *ctx, int16_t RSP, int16_t SP, int16_t EIP, int16_t R, int16_t T);
+int vm_engine_lookup(const char* name);
+context* vm_new(void);
+char** vm_meta(context *ctx);
+bool vm_memory(context *ctx, uint64_t bytes, int flags);
+void vm_memory_release(context *ctx);
+int16_t vm_ext_memory(context *ctx, uint8_t op, int16_t SP);
+int16_t vm_ext_dict(context *ctx, int16_t SP);
+void vm_dict_invalidate(context *ctx, uint64_t addr, uint64_t len);
+void vm_dict_release(context *ctx);
+bool vm_stacks(context *ctx, uint32_t dstack_cells, uint32_t rstack_cells);
+void vm_stacks_release(context *ctx);
+int vm_stacks_guard(context *ctx, int (*run)(context *ctx));
+int vm_switch(context *ctx);
+int vm_traced(context *ctx);
+int vm_threaded(context *ctx);
+int vm_predecoded(context *ctx);
+int vm_generated(context *ctx);
+int vm_jit(context *ctx);
+int vm_stackcache(context *ctx);
+void vm_predecode(context *ctx);
+void vm_predecode_invalidate(context *ctx, uint32_t addr, uint32_t count);
+void vm_jit_invalidate(context *ctx, uint32_t addr, uint32_t count);
+void vm_jit_release(context *ctx);
+void vm_invalidate_code(context *ctx, uint32_t addr, uint32_t count);
+void vm_release(context *ctx);
+void vm_profile_record(context *ctx, uint16_t raw);
+void vm_profile_report(context *ctx, FILE *out, size_t top);
 int vm(context *ctx);
+int vm_run(context *ctx, uint64_t max_cycles);
+void vm_trace(context *ctx, FILE *out);
+bool vm_trace_ring_open(context *ctx, const char *path, uint64_t records);
+void vm_trace_ring_close(context *ctx);
+bool vm_image_load(context *ctx, const char *path);
+struct vm_snapshot* vm_snapshot(context *ctx);
+context* vm_clone(struct vm_snapshot *snap);
+void vm_clone_release(context *ctx);
+void vm_snapshot_release(struct vm_snapshot *snap);
+
+// Runs `INS_EXT()` operation `op` on the data stack, with T already stored
+// at `SP-1`, and returns the new SP.  Double cells are low cell first, as in
+// Forth.  Dividing by zero gives a quotient of all ones and leaves the
+// dividend as the remainder; a quotient too big for a cell is truncated.
+static inline int16_t vm_ext(context *ctx, uint8_t op, int16_t SP) {
+    int64_t *S = ctx->DSTACK;
+    switch (op) {
+        case EXT_UM_MUL: {
+            unsigned __int128 p = (unsigned __int128)(uint64_t)S[SP-2] *
+                                  (uint64_t)S[SP-1];
+            S[SP-2] = (int64_t)p;
+            S[SP-1] = (int64_t)(p >> 64);
+            return SP;
+        }
+        case EXT_M_MUL: {
+            __int128 p = (__int128)S[SP-2] * S[SP-1];
+            S[SP-2] = (int64_t)p;
+            S[SP-1] = (int64_t)((unsigned __int128)p >> 64);
+            return SP;
+        }
+        case EXT_UM_MOD:
+        case EXT_SM_REM: {
+            unsigned __int128 d = (unsigned __int128)(uint64_t)S[SP-2] << 64 |
+                                  (uint64_t)S[SP-3];
+            int64_t n = S[SP-1];
+            if (!n) {
+                S[SP-2] = -1;
+            } else if (op == EXT_UM_MOD) {
+                S[SP-3] = (int64_t)(d % (uint64_t)n);
+                S[SP-2] = (int64_t)(d / (uint64_t)n);
+            } else if (n == -1) {
+                // The one signed division that can overflow.
+                S[SP-3] = 0;
+                S[SP-2] = (int64_t)-d;
+            } else {
+                S[SP-3] = (int64_t)((__int128)d % n);
+                S[SP-2] = (int64_t)((__int128)d / n);
+            }
+            return SP - 1;
+        }
+        case EXT_U_DIV_MOD:
+        case EXT_DIV_MOD: {
+            int64_t n = S[SP-2], d = S[SP-1];
+            if (!d) {
+                S[SP-1] = -1;
+            } else if (op == EXT_U_DIV_MOD) {
+                S[SP-2] = (int64_t)((uint64_t)n % (uint64_t)d);
+                S[SP-1] = (int64_t)((uint64_t)n / (uint64_t)d);
+            } else if (d == -1) {
+                S[SP-2] = 0;
+                S[SP-1] = (int64_t)-(uint64_t)n;
+            } else {
+                S[SP-2] = n % d;
+                S[SP-1] = n / d;
+            }
+            return SP;
+        }
+        case EXT_POPCOUNT:
+            S[SP-1] = __builtin_popcountll(S[SP-1]);
+            return SP;
+        case EXT_CLZ:
+            S[SP-1] = S[SP-1] ? __builtin_clzll(S[SP-1]) : 64;
+            return SP;
+        case EXT_CTZ:
+            S[SP-1] = S[SP-1] ? __builtin_ctzll(S[SP-1]) : 64;
+            return SP;
+        case EXT_MIN:
+            if (S[SP-1] < S[SP-2]) S[SP-2] = S[SP-1];
+            return SP - 1;
+        case EXT_MAX:
+            if (S[SP-1] > S[SP-2]) S[SP-2] = S[SP-1];
+            return SP - 1;
+        case EXT_UMIN:
+            if ((uint64_t)S[SP-1] < (uint64_t)S[SP-2]) S[SP-2] = S[SP-1];
+            return SP - 1;
+        case EXT_UMAX:
+            if ((uint64_t)S[SP-1] > (uint64_t)S[SP-2]) S[SP-2] = S[SP-1];
+            return SP - 1;
+        case EXT_ARSHIFT:
+            S[SP-2] = (uint64_t)S[SP-1] < 64 ? S[SP-2] >> S[SP-1]
+                                             : (S[SP-2] < 0 ? -1 : 0);
+            return SP - 1;
+        case EXT_ROL:
+        case EXT_ROR: {
+            uint64_t u = S[SP-2];
+            unsigned k = (op == EXT_ROL ? S[SP-1] : -S[SP-1]) & 63;
+            S[SP-2] = (int64_t)(k ? u << k | u >> (64 - k) : u);
+            return SP - 1;
+        }
+        case EXT_BSWAP:
+            S[SP-1] = (int64_t)__builtin_bswap64(S[SP-1]);
+            return SP;
+        case EXT_CMOVE:
+        case EXT_CMOVE_UP:
+        case EXT_MOVE:
+        case EXT_FILL:
+        case EXT_COMPARE:
+            return vm_ext_memory(ctx, op, SP);
+        case EXT_SEARCH_WORDLIST:
+            return vm_ext_dict(ctx, SP);
+        default:
+            return SP;
+    }
+}
 
 #endif //HEXAFORTH_VM_H
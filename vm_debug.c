@@ -18,13 +18,13 @@
 // }
 
 void debug_address(char* decoded, context* ctx, uint64_t addr) {
-    char* meta = ctx->meta[addr];
+    char* meta = ctx->meta && addr < VM_META_CELLS ? ctx->meta[addr] : NULL;
     char* target_meta = NULL;
     char decoded_ins[160];
     const char* forth_word = NULL;
 
     instruction ins = *(instruction*)&ctx->memory[addr];
-    if (!ins.lit.lit_f && ins.alu.op_type != OP_TYPE_ALU) {
+    if (ctx->meta && !ins.lit.lit_f && ins.alu.op_type != OP_TYPE_ALU) {
         target_meta = ctx->meta[ins.jmp.target];
     }
     decode_instruction(decoded_ins, ins, ctx->words);
@@ -35,6 +35,9 @@ void debug_address(char* decoded, context* ctx, uint64_t addr) {
             target_meta ? target_meta : "");
 }
 
+// Writes to `ctx->OUT` directly, so a caller in the VM flushes the buffered
+// output with `vm_out_flush()` first.  This file is also linked into tools
+// without vm.c, so it doesn't do so itself.
 void debug_monitor(int64_t T, int16_t R,
                    int16_t EIP, int16_t SP, int16_t RSP,
                    context *ctx) {
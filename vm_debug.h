@@ -17,13 +17,14 @@ static bool DEBUG_ENABLED = true;
 #define dprintf(...)
 #endif
 
-#if defined(DEBUG) || defined(TEST)
 void debug_address(char* out, context* ctx, uint64_t addr);
 void show_registers(int64_t T, int16_t R,
                     int16_t EIP, int16_t SP, int16_t RSP,
                     context *ctx);
 void mini_stack(int16_t P, int64_t TOS, int64_t* stack, char* buf);
 
+#if defined(DEBUG) || defined(TEST)
+
 // Debug monitor commands
 
 typedef struct {
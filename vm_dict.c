@@ -0,0 +1,284 @@
+//
+// vm_dict.c - a hashed index over the dictionary, for `search-wordlist`.
+//
+// Finding a word by walking the header chain compares its name with every
+// header newer than it.  The index maps names to headers instead, in an
+// open-addressed table beside the context, so a lookup costs one hash and
+// a probe or two.  Headers are laid out as nuc.fs's `mkheader` writes them:
+//
+//     [link, low bit set if immediate] [count] [name] [align to 2] [xt]
+//
+// all 16 bits, with a wordlist being the cell that holds its newest header.
+// The chain itself is left alone, so `words` and older header walks still
+// work.  The index remembers the header it was built up to: when the
+// wordlist has grown it indexes the new headers, oldest first so that later
+// definitions shadow earlier ones, and when the head has moved anywhere else
+// it starts again.  Every hit is checked against the name in memory, and
+// `vm_dict_invalidate()` drops the index when a bulk write lands on a header
+// it covers; otherwise a header is taken not to change once it is in the
+// chain, bar its immediate bit.  Writes anywhere else, string buffers and
+// headers not linked in yet included, leave it be.
+//
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+
+// Slots of a new index, and the most headers a chain is walked through: a
+// header takes at least 6 bytes of the 64K a link can reach.
+#define DICT_MIN_SLOTS 256
+#define DICT_MAX_HEADERS (65536 / 6)
+
+// The bytes a header takes, from its link to the end of its xt.
+struct dict_header {
+    uint16_t   at;
+    uint32_t   end;
+};
+
+struct vm_dict {
+    uint64_t            wid;        // address of the cell holding the head
+    uint16_t            head;       // newest header indexed
+    uint32_t            count;      // slots in use
+    uint32_t            mask;       // slots - 1, a power of two less one
+    struct dict_header  *headers;   // every header indexed, oldest first
+    uint32_t            indexed;    // headers in use
+    uint32_t            room;       // headers allocated
+    bool                ascending;  // each header above the one before
+    uint16_t            slots[];    // header addresses, 0 if empty
+};
+
+// Names match as nuc.fs's `i<>` does, ignoring ASCII case.
+static inline uint8_t dict_lower(uint8_t c) {
+    return c >= 'A' && c <= 'Z' ? c + 0x20 : c;
+}
+
+static uint32_t dict_hash(const uint8_t *name, uint8_t len) {
+    uint32_t hash = 2166136261u ^ len;
+    for (uint8_t idx = 0; idx < len; idx++) {
+        hash = (hash ^ dict_lower(name[idx])) * 16777619u;
+    }
+    return hash;
+}
+
+static bool dict_same(const uint8_t *memory, uint16_t wp,
+                      const uint8_t *name, uint8_t len) {
+    if (memory[wp + 2] != len) {
+        return false;
+    }
+    for (uint8_t idx = 0; idx < len; idx++) {
+        if (dict_lower(memory[wp + 3 + idx]) != dict_lower(name[idx])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The slot holding a header named `name`, or the empty slot it would go in.
+static uint32_t dict_slot(const struct vm_dict *dict, const uint8_t *memory,
+                          const uint8_t *name, uint8_t len) {
+    uint32_t slot = dict_hash(name, len) & dict->mask;
+    while (dict->slots[slot] &&
+           !dict_same(memory, dict->slots[slot], name, len)) {
+        slot = (slot + 1) & dict->mask;
+    }
+    return slot;
+}
+
+static struct vm_dict* dict_alloc(uint64_t wid, uint32_t slots) {
+    struct vm_dict *dict = calloc(1, sizeof(struct vm_dict) +
+                                     slots * sizeof(uint16_t));
+    if (dict) {
+        dict->wid = wid;
+        dict->mask = slots - 1;
+        dict->ascending = true;
+    }
+    return dict;
+}
+
+static void dict_free(struct vm_dict *dict) {
+    if (dict) {
+        free(dict->headers);
+        free(dict);
+    }
+}
+
+// Index header `wp`, replacing any older header of the same name.  The
+// table doubles whenever it would be more than half full.
+static bool dict_insert(struct vm_dict **dictp, const uint8_t *memory,
+                        uint16_t wp) {
+    struct vm_dict *dict = *dictp;
+    if ((dict->count + 1) * 2 > dict->mask + 1) {
+        struct vm_dict *grown = dict_alloc(dict->wid, (dict->mask + 1) * 2);
+        if (!grown) {
+            return false;
+        }
+        grown->head = dict->head;
+        grown->headers = dict->headers;
+        grown->indexed = dict->indexed;
+        grown->room = dict->room;
+        grown->ascending = dict->ascending;
+        for (uint32_t idx = 0; idx <= dict->mask; idx++) {
+            uint16_t at = dict->slots[idx];
+            if (at) {
+                grown->slots[dict_slot(grown, memory, &memory[at + 3],
+                                       memory[at + 2])] = at;
+                grown->count++;
+            }
+        }
+        free(dict);
+        *dictp = dict = grown;
+    }
+    uint32_t slot = dict_slot(dict, memory, &memory[wp + 3], memory[wp + 2]);
+    dict->count += !dict->slots[slot];
+    dict->slots[slot] = wp;
+    return true;
+}
+
+static inline uint16_t dict_link(const uint8_t *memory, uint16_t wp) {
+    return *(uint16_t*)&memory[wp] & ~1;
+}
+
+// Index the headers from `head` back to, but not including, `upto`.  False
+// if the chain ends or runs too long before reaching it.  The chain is
+// walked twice, once to count it and once to list it oldest first.
+static bool dict_extend(struct vm_dict **dictp, const uint8_t *memory,
+                        uint16_t head, uint16_t upto) {
+    struct vm_dict *dict = *dictp;
+    uint32_t count = 0;
+    for (uint16_t wp = head; wp != upto; wp = dict_link(memory, wp)) {
+        if (!wp || dict->indexed + count == DICT_MAX_HEADERS) {
+            return false;
+        }
+        count++;
+    }
+    uint32_t indexed = dict->indexed + count;
+    if (indexed > dict->room) {
+        uint32_t room = dict->room ? dict->room * 2 : DICT_MIN_SLOTS;
+        while (room < indexed) {
+            room *= 2;
+        }
+        struct dict_header *headers = realloc(dict->headers,
+                                              room * sizeof(*headers));
+        if (!headers) {
+            return false;
+        }
+        dict->headers = headers;
+        dict->room = room;
+    }
+    uint32_t idx = indexed;
+    for (uint16_t wp = head; idx > dict->indexed;
+         wp = dict_link(memory, wp)) {
+        struct dict_header *header = &dict->headers[--idx];
+        header->at = wp;
+        header->end = ((wp + 3 + memory[wp + 2] + 1) & ~1) + 2;
+    }
+    for (idx = dict->indexed; idx < indexed; idx++) {
+        if (idx && dict->headers[idx].at < dict->headers[idx - 1].end) {
+            dict->ascending = false;
+        }
+        if (!dict_insert(dictp, memory, dict->headers[idx].at)) {
+            return false;
+        }
+        dict = *dictp;
+        dict->indexed = idx + 1;
+    }
+    dict->head = head;
+    return true;
+}
+
+// Bring `ctx`'s index up to date with the wordlist at `wid`, or drop it if
+// that can't be done.
+static struct vm_dict* dict_sync(context *ctx, uint64_t wid, uint16_t head) {
+    const uint8_t *memory = (const uint8_t*)ctx->memory;
+    if (ctx->dict && ctx->dict->wid == wid) {
+        if (ctx->dict->head == head ||
+            dict_extend(&ctx->dict, memory, head, ctx->dict->head)) {
+            return ctx->dict;
+        }
+    }
+    vm_dict_release(ctx);
+    ctx->dict = dict_alloc(wid, DICT_MIN_SLOTS);
+    if (ctx->dict && !dict_extend(&ctx->dict, memory, head, 0)) {
+        vm_dict_release(ctx);
+    }
+    return ctx->dict;
+}
+
+// `EXT_SEARCH_WORDLIST` for `vm_ext()`.  A chain the index can't be built
+// over, one that loops for instance, is searched header by header instead.
+int16_t vm_ext_dict(context *ctx, int16_t SP) {
+    int64_t *S = ctx->DSTACK;
+    const uint8_t *memory = (const uint8_t*)ctx->memory;
+    uint64_t addr = S[SP-3];
+    uint64_t len = S[SP-2];
+    uint64_t wid = S[SP-1];
+    S[SP-3] = 0;
+    if (!len || len > 255 || addr > ctx->MEMORY_BYTES ||
+        len > ctx->MEMORY_BYTES - addr || wid > ctx->MEMORY_BYTES - 2) {
+        return SP - 2;
+    }
+    const uint8_t *name = &memory[addr];
+    uint16_t head = *(uint16_t*)&memory[wid] & ~1;
+    uint16_t wp = 0;
+    struct vm_dict *dict = dict_sync(ctx, wid, head);
+    if (dict) {
+        wp = dict->slots[dict_slot(dict, memory, name, len)];
+    } else {
+        uint16_t at = head;
+        for (uint32_t count = 0; at && count < DICT_MAX_HEADERS; count++) {
+            if (dict_same(memory, at, name, len)) {
+                wp = at;
+                break;
+            }
+            at = *(uint16_t*)&memory[at] & ~1;
+        }
+    }
+    if (!wp) {
+        return SP - 2;
+    }
+    S[SP-3] = *(uint16_t*)&memory[(wp + 3 + len + 1) & ~1];
+    S[SP-2] = memory[wp] & 1 ? 1 : -1;
+    return SP - 1;
+}
+
+// Drop `ctx`'s index if any of the `len` bytes from `addr` were part of a
+// header it covers.  The extents are the ones the headers had when they
+// were indexed, since the write may already have changed them.
+void vm_dict_invalidate(context *ctx, uint64_t addr, uint64_t len) {
+    const struct vm_dict *dict = ctx->dict;
+    if (!dict || !len) {
+        return;
+    }
+    uint64_t end = addr + len;
+    const struct dict_header *headers = dict->headers;
+    if (!dict->ascending) {
+        for (uint32_t idx = 0; idx < dict->indexed; idx++) {
+            if (headers[idx].at < end && addr < headers[idx].end) {
+                vm_dict_release(ctx);
+                return;
+            }
+        }
+        return;
+    }
+    // The last header starting before `end` is the only one that can
+    // reach past `addr`.
+    uint32_t low = 0;
+    uint32_t high = dict->indexed;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (headers[mid].at < end) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low && addr < headers[low - 1].end) {
+        vm_dict_release(ctx);
+    }
+}
+
+void vm_dict_release(context *ctx) {
+    dict_free(ctx->dict);
+    ctx->dict = NULL;
+}
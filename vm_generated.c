@@ -0,0 +1,47 @@
+//
+// vm_generated.c - engine calling through the generated 64K handler table.
+//
+// The raw instruction word indexes `VM_HANDLERS[]` directly; no instruction
+// fields are decoded here.  See vm_handlers.h and util/handler_table_gen.c.
+//
+
+#include "vm_handlers.h"
+#ifdef DEBUG
+#include "vm_debug.h"
+#include "vm_opcodes.h"
+#endif // DEBUG
+
+int vm_generated(context *ctx) {
+    vm_regs r = {
+            .ctx = ctx,
+            .T = ctx->DSTACK[ctx->SP-1],
+            .R = ctx->RSTACK[ctx->RSP-1],
+            .EIP = ctx->EIP,
+            .SP = ctx->SP,
+            .RSP = ctx->RSP };
+    uint64_t cycles = ctx->CYCLES;
+    uint64_t limit = ctx->CYCLE_LIMIT;
+    uint16_t raw;
+
+    // The budget is checked before every instruction: one compare next to
+    // an indirect call.
+    while ((raw = ctx->memory[(uint16_t)r.EIP]) && cycles < limit) {
+#ifdef DEBUG
+        print_state(ctx, r.RSP, r.SP, r.EIP, r.R, r.T);
+#endif // DEBUG
+        r.EIP++;
+        cycles++;
+        VM_HANDLERS[raw](&r, raw);
+    }
+#ifdef DEBUG
+    print_state(ctx, r.RSP, r.SP, r.EIP, r.R, r.T);
+#endif
+    ctx->CYCLES = cycles;
+    ctx->DSTACK[r.SP-1] = r.T;
+    ctx->RSTACK[r.RSP-1] = r.R;
+    ctx->SP = r.SP;
+    ctx->RSP = r.RSP;
+    ctx->EIP = r.EIP;
+    vm_out_flush(ctx);
+    return raw ? VM_PREEMPTED : VM_HALTED;
+}
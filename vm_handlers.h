@@ -0,0 +1,185 @@
+//
+// vm_handlers.h - handler bodies for the generated 64K handler table.
+//
+// `handler-table-gen` (util/handler_table_gen.c) writes vm_handlers_gen.c,
+// which expands `HANDLER_ALU()` once for every ALU encoding and fills
+// `VM_HANDLERS[]` so that the raw 16-bit word indexes its handler directly.
+// Each ALU handler calls `vm_alu()` with constant field values, so after
+// inlining its mux and op switches are gone.
+//
+
+#ifndef HEXAFORTH_VM_HANDLERS_H
+#define HEXAFORTH_VM_HANDLERS_H
+
+#include <stdbool.h>
+#include "vm.h"
+#include "vm_instruction.h"
+#include "vm_constants.h"
+
+// VM registers the handlers operate on; `vm_generated()` owns these.
+typedef struct {
+    context*   ctx;
+    int64_t    T;
+    int64_t    R;
+    int16_t    EIP;
+    int16_t    SP;
+    int16_t    RSP;
+    uint64_t   budget;      // JIT: instructions a block may loop through
+} vm_regs;
+
+typedef void (*vm_handler)(vm_regs* r, uint16_t raw);
+
+extern const vm_handler VM_HANDLERS[65536];
+
+static inline __attribute__((always_inline))
+void vm_alu(vm_regs* r, BYTE in_mux, BYTE alu_op, BYTE out_mux,
+            SBYTE dstack, SBYTE rstack, bool r_eip) {
+    context* ctx = r->ctx;
+    int64_t T = r->T;
+    int64_t R = r->R;
+    int16_t SP = r->SP;
+    int16_t RSP = r->RSP;
+    int64_t N = ctx->DSTACK[SP-2];
+    int64_t IN = 0;
+    int64_t OUT = 0;
+
+    // `T->IN [IN]` with a width, see `INS_NARROW()`.
+    if (in_mux == INPUT_T && alu_op == ALU_LOAD && rstack && !r_eip) {
+        SP += dstack;
+        if (dstack > 0) {
+            ctx->DSTACK[SP - 2] = T;
+        }
+        if (out_mux != OUTPUT_MEM_T) {
+            T = vm_load_narrow(ctx, T, (BYTE)rstack & 3);
+        } else {
+            vm_store_narrow(ctx, T, N, (BYTE)rstack & 3);
+            if (dstack < 0) T = ctx->DSTACK[SP - 1];
+        }
+        r->T = T;
+        r->SP = SP;
+        return;
+    }
+    // `T->IN IN<<T`, see `INS_EXT()`.
+    if (in_mux == INPUT_T && alu_op == ALU_LSHIFT && !r_eip) {
+        ctx->DSTACK[SP - 1] = T;
+        SP = vm_ext(ctx, (BYTE)(out_mux << 4 | ((BYTE)dstack & 3) << 2 |
+                                ((BYTE)rstack & 3)), SP);
+        r->T = ctx->DSTACK[SP - 1];
+        r->SP = SP;
+        return;
+    }
+    switch (in_mux) {
+        case INPUT_N: IN = N; break;
+        case INPUT_T: IN = T; break;
+        case INPUT_LOAD_T:
+            IN = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+T);
+            break;
+        case INPUT_R: IN = R; break;
+    }
+    switch (alu_op) {
+        case ALU_IN: OUT = IN; break;
+        case ALU_ADD: OUT = IN + N; break;
+        case ALU_T_N:
+            ctx->DSTACK[SP - 2] = T;
+            OUT = IN;
+            break;
+        case ALU_SWAP_IN:
+            OUT = ctx->DSTACK[SP - 2];
+            ctx->DSTACK[SP - 2] = T;
+            T = OUT;
+            OUT = IN;
+            break;
+        case ALU_AND: OUT = IN & N; break;
+        case ALU_OR: OUT = IN | N; break;
+        case ALU_XOR: OUT = IN ^ N; break;
+        case ALU_INVERT: OUT = ~IN; break;
+        case ALU_EQ: OUT = IN == N ? TRUE : FALSE; break;
+        case ALU_GT: OUT = N < IN ? TRUE : FALSE; break;
+        case ALU_RSHIFT: OUT = (uint64_t) IN >> T; break;
+        case ALU_LSHIFT: OUT = (uint64_t) IN << T; break;
+        case ALU_MUL: OUT = IN * N; break;
+        case ALU_LOAD:
+            OUT = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+IN);
+            break;
+        case ALU_IO_READ: OUT = io_read_handler(ctx, IN); break;
+        case ALU_U_GT:
+            OUT = (uint64_t) N < (uint64_t) IN ? TRUE : FALSE;
+            break;
+    }
+    if (r_eip) r->EIP = R;
+    SP += dstack;
+    RSP += rstack;
+    if (dstack > 0) {
+        ctx->DSTACK[SP - 2] = T;
+    }
+    if (rstack > 0) {
+        ctx->RSTACK[RSP - 2] = R;
+    }
+    switch (out_mux) {
+        case OUTPUT_T:
+            T = OUT;
+            if (rstack < 0) R = ctx->RSTACK[RSP - 1];
+            break;
+        case OUTPUT_R:
+            R = OUT;
+            if (dstack < 0) T = ctx->DSTACK[SP - 1];
+            break;
+        case OUTPUT_IO_T:
+            ctx->SP = SP;
+            ctx->RSP = RSP;
+            ctx->EIP = r->EIP;
+            io_write_handler(ctx, T, OUT);
+            if (dstack < 0) T = ctx->DSTACK[SP - 1];
+            if (rstack < 0) R = ctx->RSTACK[RSP - 1];
+            break;
+        case OUTPUT_MEM_T:
+            *(int64_t*)((uint8_t*)(&ctx->memory[0])+T) = OUT;
+            if (dstack < 0) T = ctx->DSTACK[SP - 1];
+            if (rstack < 0) R = ctx->RSTACK[RSP - 1];
+            break;
+    }
+    r->T = T;
+    r->R = R;
+    r->SP = SP;
+    r->RSP = RSP;
+}
+
+#define HANDLER_ALU(ID, IN_MUX, ALU_OP, OUT_MUX, D, R, R_EIP)               \
+    static void vm_alu_##ID(vm_regs* r, uint16_t raw) {                     \
+        vm_alu(r, IN_MUX, ALU_OP, OUT_MUX, D, R, R_EIP);                    \
+    }
+
+// Literal and jump handlers differ per encoding only in their immediate,
+// so one handler per shift/add pair or per jump type covers them.
+#define HANDLER_LIT(SHIFTS)                                                 \
+    static void vm_lit_##SHIFTS(vm_regs* r, uint16_t raw) {                 \
+        r->ctx->DSTACK[r->SP-1] = r->T;                                     \
+        r->SP++;                                                            \
+        r->T = (int64_t)((uint64_t)(raw & 0xfff) << (SHIFTS * LIT_BITS));   \
+    }                                                                       \
+    static void vm_lit_add_##SHIFTS(vm_regs* r, uint16_t raw) {             \
+        r->T += (int64_t)((uint64_t)(raw & 0xfff) << (SHIFTS * LIT_BITS));  \
+    }
+
+static void vm_jmp(vm_regs* r, uint16_t raw) {
+    r->EIP = raw & 0x1fff;
+}
+
+static void vm_cjmp(vm_regs* r, uint16_t raw) {
+    r->SP--;
+    bool RES = (uint64_t)r->T;
+    r->T = r->ctx->DSTACK[r->SP-1];
+    if (!RES) {
+        r->EIP = raw & 0x1fff;
+    }
+}
+
+static void vm_call(vm_regs* r, uint16_t raw) {
+    r->ctx->RSTACK[r->RSP-1] = r->R;
+    r->R = r->EIP;
+    r->ctx->RSTACK[r->RSP] = r->EIP;
+    r->RSP++;
+    r->EIP = raw & 0x1fff;
+}
+
+#endif //HEXAFORTH_VM_HANDLERS_H
@@ -0,0 +1,95 @@
+//
+// vm_image.c - loads binary images written by hex2img.
+//
+// The image is mapped read-only and its memory sections are copied into
+// `ctx->memory` in one `memcpy()` each; `ctx->meta` points at the names in
+// the mapping, so nothing is parsed or allocated per word.  An image with
+// symbols stays mapped, as the context's symbols live in it; one without is
+// unmapped once it is copied.
+//
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vm.h"
+#include "vm_image.h"
+
+#if IMAGE_SYMBOL_CELLS > VM_META_CELLS
+#error "image symbols must fit in ctx->meta"
+#endif
+
+static bool image_section_valid(const image_section *section, size_t size) {
+    return section->offset <= size && section->size <= size - section->offset;
+}
+
+// A memory section must fit below `VM_CODE_CELLS`, without `base + count`
+// wrapping around to pass.
+static bool image_cells_valid(const image_section *section) {
+    return section->size == section->count * sizeof(uint16_t) &&
+           section->base <= VM_CODE_CELLS &&
+           section->count <= VM_CODE_CELLS - section->base;
+}
+
+// Load the image at `path` into `ctx`.  Returns false, with `ctx->memory`
+// untouched, if the file can't be mapped or is not a valid image.
+bool vm_image_load(context *ctx, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(image_header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const image_header *header = (const image_header*)map;
+    bool valid = memcmp(header->magic, IMAGE_MAGIC,
+                        sizeof(header->magic)) == 0 &&
+                 header->here <= VM_CODE_CELLS;
+    for (int idx = 0; valid && idx < IMAGE_SECTION_COUNT; idx++) {
+        const image_section *section = &header->sections[idx];
+        valid = image_section_valid(section, size);
+        if (valid && idx != IMAGE_SYMBOLS) {
+            valid = image_cells_valid(section);
+        }
+    }
+    const image_section *symbols = &header->sections[IMAGE_SYMBOLS];
+    const image_symbol *symbol = (const image_symbol*)(map + symbols->offset);
+    valid = valid &&
+            symbols->count <= symbols->size / sizeof(image_symbol);
+    for (uint32_t idx = 0; valid && idx < symbols->count; idx++) {
+        valid = symbol[idx].addr < IMAGE_SYMBOL_CELLS &&
+                symbol[idx].name < size &&
+                memchr(map + symbol[idx].name, '\0',
+                       size - symbol[idx].name) != NULL;
+    }
+    if (!valid) {
+        munmap(map, size);
+        return false;
+    }
+
+    for (int idx = IMAGE_CODE; idx <= IMAGE_DICT; idx++) {
+        const image_section *section = &header->sections[idx];
+        memcpy(&ctx->memory[section->base], map + section->offset,
+               section->size);
+    }
+    char **meta = symbols->count ? vm_meta(ctx) : ctx->meta;
+    for (uint32_t idx = 0; meta && idx < symbols->count; idx++) {
+        meta[symbol[idx].addr] = (char*)map + symbol[idx].name;
+    }
+    ctx->HERE = header->here;
+    if (!symbols->count || !meta) {
+        munmap(map, size);
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+//
+// vm_image.h - binary image format.
+//
+// A `.img` file is what `load_hex()` builds from a cross.fs `.hex` file,
+// laid out so it can be loaded without parsing: a header, then the code,
+// data and dictionary sections as raw cells in host byte order, then a
+// symbol section for `ctx->meta`.  hex2img writes images; `vm_image_load()`
+// maps one and copies its sections into a context.
+//
+
+#ifndef HEXAFORTH_VM_IMAGE_H
+#define HEXAFORTH_VM_IMAGE_H
+
+#include <stdint.h>
+
+#define IMAGE_MAGIC "HXIMAGE1"
+
+// === IMAGE_SECTION: the sections of an image, in file order.
+enum IMAGE_SECTION {
+    IMAGE_CODE = 0,        // cells from 0 up to the first gap
+    IMAGE_DATA = 1,        // cells between the code and the dictionary
+    IMAGE_DICT = 2,        // dictionary entries, oldest first
+    IMAGE_SYMBOLS = 3,     // `image_symbol`s, then their names
+    IMAGE_SECTION_COUNT
+};
+
+typedef struct {
+    uint32_t   offset;          // bytes from the start of the file
+    uint32_t   size;            // bytes
+    uint32_t   base;            // first cell, for the memory sections
+    uint32_t   count;           // cells, or symbols
+} image_section;
+
+typedef struct {
+    char          magic[8];
+    uint32_t      here;         // `ctx->HERE` after loading
+    uint32_t      reserved;
+    image_section sections[IMAGE_SECTION_COUNT];
+} image_header;
+
+// Symbols name cells below this, the size of `ctx->meta`.
+#define IMAGE_SYMBOL_CELLS 32768
+
+// `name` is a NUL-terminated string at that offset from the start of the
+// file, so a mapped image can point `ctx->meta` straight at it.
+typedef struct {
+    uint32_t   addr;
+    uint32_t   name;
+} image_symbol;
+
+#endif //HEXAFORTH_VM_IMAGE_H
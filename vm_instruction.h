@@ -82,4 +82,62 @@ enum OUTPUT_MUX {
     OUTPUT_MEM_T = 3,  // ->[T]     write result to memory address T
 };
 
+// `T->IN [IN]` loads the same cell as `[T]->IN IN->`, so that combination is
+// reclaimed for loads and stores narrower than a cell.  With a nonzero
+// `rstack` field and no `RET`, the field gives the width instead of moving
+// the return stack.  `->[T]` stores the low bytes of N at T; any other output
+// loads the bytes at T into T, zero-extended.  The data stack moves as for
+// any ALU instruction.
+enum MEM_WIDTH {
+    MEM_CELL = 0,      // r+0       the plain 64-bit `[IN]`
+    MEM_32 = 1,        // r+1       4 bytes
+    MEM_16 = 2,        // r-2       2 bytes
+    MEM_8 = 3,         // r-1       1 byte
+};
+
+// For an ALU instruction: is it a narrow load or store, and of what width?
+#define INS_NARROW(ins) ((ins).alu.in_mux == INPUT_T &&                     \
+                         (ins).alu.alu_op == ALU_LOAD &&                    \
+                         (ins).alu.rstack && !(ins).alu.r_eip)
+#define INS_WIDTH(ins)  ((BYTE)(ins).alu.rstack & 3)
+
+// `T->IN IN<<T` shifts T by itself, which nothing wants, so without `RET`
+// that combination is reclaimed as a second page of operations that don't
+// fit the ALU.  The `out_mux`, `dstack` and `rstack` bits number the
+// operation instead, giving 64 of them, and each one takes and leaves its
+// own items on the data stack.  Unassigned numbers do nothing.  The
+// assembler spells them `ext:<name>`, see `EXT_FIELD()`.
+enum EXT_OPS {
+    EXT_UM_MUL = 0,    // ( u1 u2 -- ud )            unsigned 128-bit product
+    EXT_M_MUL = 1,     // ( n1 n2 -- d )             signed 128-bit product
+    EXT_UM_MOD = 2,    // ( ud u -- rem quot )       unsigned 128/64 divide
+    EXT_SM_REM = 3,    // ( d n -- rem quot )        signed, symmetric
+    EXT_U_DIV_MOD = 4, // ( u1 u2 -- rem quot )      unsigned 64/64 divide
+    EXT_DIV_MOD = 5,   // ( n1 n2 -- rem quot )      signed, symmetric
+    EXT_POPCOUNT = 6,  // ( u -- n )                 bits set
+    EXT_CLZ = 7,       // ( u -- n )                 leading zeros, 64 for 0
+    EXT_CTZ = 8,       // ( u -- n )                 trailing zeros, 64 for 0
+    EXT_MIN = 9,       // ( n1 n2 -- n )
+    EXT_MAX = 10,      // ( n1 n2 -- n )
+    EXT_UMIN = 11,     // ( u1 u2 -- u )
+    EXT_UMAX = 12,     // ( u1 u2 -- u )
+    EXT_ARSHIFT = 13,  // ( n u -- n>>u )            shifting in the sign
+    EXT_ROL = 14,      // ( u1 u -- u2 )             rotate left by u mod 64
+    EXT_ROR = 15,      // ( u1 u -- u2 )             rotate right by u mod 64
+    EXT_BSWAP = 16,    // ( u1 -- u2 )               reverse the 8 bytes
+    EXT_CMOVE = 17,    // ( from to u -- )           copy bytes upwards
+    EXT_CMOVE_UP = 18, // ( from to u -- )           copy bytes downwards
+    EXT_MOVE = 19,     // ( from to u -- )           copy as if by a buffer
+    EXT_FILL = 20,     // ( addr u c -- )
+    EXT_COMPARE = 21,  // ( addr1 u1 addr2 u2 -- n ) -1, 0 or 1, as memcmp
+    EXT_SEARCH_WORDLIST = 22, // ( c-addr u wid -- 0 | xt 1 | xt -1 )
+};
+
+// For an ALU instruction: is it an extended operation, and which?
+#define INS_EXT(ins)    ((ins).alu.in_mux == INPUT_T &&                     \
+                         (ins).alu.alu_op == ALU_LSHIFT && !(ins).alu.r_eip)
+#define INS_EXT_OP(ins) ((BYTE)((ins).alu.out_mux << 4 |                    \
+                                ((BYTE)(ins).alu.dstack & 3) << 2 |         \
+                                ((BYTE)(ins).alu.rstack & 3)))
+
 #endif //HEXAFORTH_VM_INSTRUCTION_H
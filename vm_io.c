@@ -0,0 +1,189 @@
+//
+// vm_io.c - the devices behind `io@` and `io!`.
+//
+// Each context maps io ports to devices, host callbacks with their own
+// data.  Ports below `IO_LOW_PORTS` index a table directly; the rest are
+// found in an open-addressed hash keyed by port, so either way finding a
+// port's device is one lookup.  A context the host never attached anything
+// to has no table of its own and uses `CONSOLE_PORTS`, which puts the
+// console from vm.c on ports 0xe0-0xe3 and 0xf0-0xf3.  The first
+// `vm_io_attach()` copies that, so a host can move or replace the console
+// as well as add devices beside it.
+//
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "vm_constants.h"
+
+// Ports with a direct table entry, and the most ports above them one
+// `vm_io_attach()` can take.
+#define IO_LOW_PORTS 256
+#define IO_HASHED_MAX 65536
+
+struct vm_device {
+    vm_io_read         read;
+    vm_io_write        write;
+    void               *data;
+    struct vm_device   *next;       // attached to the same context
+};
+
+struct io_slot {
+    uint64_t                   port;
+    const struct vm_device     *device;  // NULL if the slot is empty
+};
+
+struct vm_io {
+    const struct vm_device     *low[IO_LOW_PORTS];
+    struct io_slot             *slots;   // ports from `IO_LOW_PORTS` up
+    uint32_t                   count;   // slots in use
+    uint32_t                   mask;    // slots - 1, or 0 with no slots
+    struct vm_device           *devices;
+};
+
+static const struct vm_device console = {vm_console_read, vm_console_write};
+
+static const struct vm_device *const CONSOLE_PORTS[IO_LOW_PORTS] = {
+        [0xe0 ... 0xe3] = &console,
+        [0xf0 ... 0xf3] = &console };
+
+static inline uint32_t io_hash(uint64_t port) {
+    return (uint32_t)((port * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+// The slot holding `port`, or the empty slot it would go in.
+static inline struct io_slot* io_slot(const struct vm_io *io, uint64_t port) {
+    uint32_t slot = io_hash(port) & io->mask;
+    while (io->slots[slot].device && io->slots[slot].port != port) {
+        slot = (slot + 1) & io->mask;
+    }
+    return &io->slots[slot];
+}
+
+static inline const struct vm_device* io_device(const context *ctx,
+                                                uint64_t port) {
+    const struct vm_io *io = ctx->io;
+    if (port < IO_LOW_PORTS) {
+        return io ? io->low[port] : CONSOLE_PORTS[port];
+    }
+    if (!io || !io->count) {
+        return NULL;
+    }
+    return io_slot(io, port)->device;
+}
+
+int64_t io_write_handler(context *ctx, uint64_t io_addr, int64_t io_write) {
+    const struct vm_device *device = io_device(ctx, io_addr);
+    if (!device || !device->write) {
+        return(FALSE);
+    }
+    return device->write(ctx, io_addr, io_write, device->data);
+}
+
+int64_t io_read_handler(context *ctx, uint64_t io_addr) {
+    const struct vm_device *device = io_device(ctx, io_addr);
+    if (!device || !device->read) {
+        return(FALSE);
+    }
+    return device->read(ctx, io_addr, device->data);
+}
+
+// Make room in `io`'s hash for `more` ports, keeping it at most half full.
+static bool io_reserve(struct vm_io *io, uint64_t more) {
+    uint64_t slots = io->slots ? (uint64_t)io->mask + 1 : 0;
+    if ((io->count + more) * 2 <= slots) {
+        return true;
+    }
+    uint64_t grown = slots ? slots : 16;
+    while (grown < (io->count + more) * 2) {
+        grown *= 2;
+    }
+    struct vm_io old = *io;
+    io->slots = calloc(grown, sizeof(struct io_slot));
+    if (!io->slots) {
+        io->slots = old.slots;
+        return false;
+    }
+    io->mask = grown - 1;
+    for (uint64_t idx = 0; idx < slots; idx++) {
+        if (old.slots[idx].device) {
+            *io_slot(io, old.slots[idx].port) = old.slots[idx];
+        }
+    }
+    free(old.slots);
+    return true;
+}
+
+// Attach a device to the `count` ports from `port`, in place of whatever
+// was on them, and give it `data` whenever `read` or `write` is called.
+// Attaching with neither detaches those ports.  The callbacks run in the
+// middle of an instruction: they may read and write memory, but not the
+// stacks.  Returns false, leaving the ports as they were, if the range is
+// empty, wraps, puts more than `IO_HASHED_MAX` ports above the direct
+// table, or there is no memory for it.
+bool vm_io_attach(context *ctx, uint64_t port, uint64_t count,
+                  vm_io_read read, vm_io_write write, void *data) {
+    if (!count || port + count < port) {
+        return false;
+    }
+    uint64_t end = port + count;
+    uint64_t hashed = end <= IO_LOW_PORTS ? 0 :
+                      end - (port > IO_LOW_PORTS ? port : IO_LOW_PORTS);
+    if (hashed > IO_HASHED_MAX) {
+        return false;
+    }
+    if (!ctx->io) {
+        ctx->io = calloc(1, sizeof(struct vm_io));
+        if (!ctx->io) {
+            return false;
+        }
+        memcpy(ctx->io->low, CONSOLE_PORTS, sizeof(CONSOLE_PORTS));
+    }
+    struct vm_io *io = ctx->io;
+    struct vm_device *device = malloc(sizeof(struct vm_device));
+    if (!device || !io_reserve(io, hashed)) {
+        free(device);
+        return false;
+    }
+    *device = (struct vm_device){read, write, data, io->devices};
+    io->devices = device;
+    for (uint64_t at = port; at < end; at++) {
+        if (at < IO_LOW_PORTS) {
+            io->low[at] = device;
+            continue;
+        }
+        struct io_slot *slot = io_slot(io, at);
+        io->count += !slot->device;
+        *slot = (struct io_slot){at, device};
+    }
+    return true;
+}
+
+// For a device that can't answer until `fd` is ready: returns what the
+// device should give the VM, `VM_IO_WOULD_BLOCK`, and marks `ctx` as
+// waiting on `fd`.  Code reading such a device retries in a loop around
+// `pause`, a zero word, as nuc.fs's `key` does; halting there, the run
+// returns `VM_BLOCKED` with `ctx->WAIT_FD` set, and the next `vm_run()`
+// carries on past the `pause` and reads again.
+int64_t vm_io_block(context *ctx, int fd) {
+    ctx->BLOCKED = true;
+    ctx->WAIT_FD = fd;
+    return VM_IO_WOULD_BLOCK;
+}
+
+// Drop every device the host attached, leaving `ctx` with the console.
+void vm_io_release(context *ctx) {
+    struct vm_io *io = ctx->io;
+    if (!io) {
+        return;
+    }
+    while (io->devices) {
+        struct vm_device *next = io->devices->next;
+        free(io->devices);
+        io->devices = next;
+    }
+    free(io->slots);
+    free(io);
+    ctx->io = NULL;
+}
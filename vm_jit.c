@@ -0,0 +1,710 @@
+//
+// vm_jit.c - basic-block x86-64 JIT.
+//
+// A block starts at whatever EIP the dispatcher finds uncompiled (a branch
+// or call target, a return address, or the entry point) and runs straight
+// through literals, ALU ops and conditional jumps until an unconditional
+// jump, call, return, halt or an instruction the JIT does not handle.
+// `0branch` leaves through a side exit and the block carries on with the
+// fall-through path; a jump or call back to the block's own start becomes a
+// native loop, which leaves once it has run through `vm_regs.budget`
+// instructions so a budgeted `vm_run()` can stop it.
+//
+// Inside a block the VM registers live in host registers:
+//
+//   rbx = T    r12 = R    r13 = SP    r14 = RSP    r15 = ctx
+//   rbp = vm_regs*        r11 = instructions retired
+//
+// and are written back to the `vm_regs` in vm_handlers.h on exit.  Anything
+// the JIT doesn't handle (io reads and writes, extended ops) runs one
+// instruction at a time through the generated interpreter handlers on the
+// same `vm_regs`.
+//
+// Every compiled cell is flagged in `code_map`.  After a store to memory a
+// block checks the flags for the cells the store covered and, if any are
+// set, exits so the dispatcher can throw the code cache away.
+//
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm_handlers.h"
+#ifdef DEBUG
+#include "vm_debug.h"
+#include "vm_opcodes.h"
+#endif // DEBUG
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE   (4 << 20)       // bytes of executable code cache
+#define JIT_BLOCK_MAX   64              // instructions per block
+#define JIT_BLOCK_BYTES (16 << 10)      // upper bound on one block's code
+#define JIT_INTERPRET   ((void*)1)      // block_at[] mark: step, don't compile
+#define JIT_FLUSH       (1ULL << 63)    // set in a block's return value
+
+struct jit_state {
+    uint8_t*   code;
+    size_t     used;
+    void*      block_at[65536];
+    uint8_t    code_map[65536 + 8];     // padded for the 8-byte check
+};
+
+// Returns instructions retired, with `JIT_FLUSH` set if code was written.
+typedef uint64_t (*jit_block)(vm_regs* r);
+
+enum {
+    X86_RAX = 0, X86_RCX, X86_RDX, X86_RBX, X86_RSP, X86_RBP, X86_RSI, X86_RDI,
+    X86_R8, X86_R9, X86_R10, X86_R11, X86_R12, X86_R13, X86_R14, X86_R15
+};
+
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc };
+
+#define REG_T       X86_RBX
+#define REG_R       X86_R12
+#define REG_SP      X86_R13
+#define REG_RSP     X86_R14
+#define REG_CTX     X86_R15
+#define REG_REGS    X86_RBP
+#define REG_CYCLES  X86_R11
+#define REG_DSTACK  X86_R9
+#define REG_RSTACK  X86_R10
+
+#define OFF_MEMORY  ((int32_t)offsetof(context, memory))   // the pointer
+
+// Exits are emitted after the block body and jump to its epilogue.
+typedef struct {
+    uint8_t*   rel;         // rel32 of the jcc/jmp leading here, or NULL
+    uint16_t   retired;
+    uint16_t   eip;
+    bool       dynamic;     // EIP is in esi rather than `eip`
+    bool       flush;
+} jit_exit;
+
+typedef struct {
+    uint8_t*   p;
+    jit_exit   exits[JIT_BLOCK_MAX * 2 + 2];
+    int        num_exits;
+} jit_emitter;
+
+// == x86-64 encoding
+
+static void e8(jit_emitter* e, uint8_t b) {
+    *e->p++ = b;
+}
+
+static void e16(jit_emitter* e, uint16_t v) {
+    memcpy(e->p, &v, 2);
+    e->p += 2;
+}
+
+static void e32(jit_emitter* e, uint32_t v) {
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static void e64(jit_emitter* e, uint64_t v) {
+    memcpy(e->p, &v, 8);
+    e->p += 8;
+}
+
+static void emit_rex(jit_emitter* e, int w, int reg, int index, int base) {
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) |
+                  ((index > 0 ? index >> 3 : 0) << 1) | (base >> 3);
+    if (rex != 0x40) e8(e, rex);
+}
+
+// ModRM/SIB for [base + index*scale + disp32]; `index` < 0 for none.
+static void emit_modrm_mem(jit_emitter* e, int reg, int base, int index,
+                           int scale, int32_t disp) {
+    if (index < 0 && (base & 7) != X86_RSP) {
+        e8(e, 0x80 | (reg & 7) << 3 | (base & 7));
+    } else {
+        e8(e, 0x84 | (reg & 7) << 3);
+        if (index < 0) {
+            e8(e, 0x24);
+        } else {
+            e8(e, (scale == 8 ? 3 : 0) << 6 | (index & 7) << 3 | (base & 7));
+        }
+    }
+    e32(e, disp);
+}
+
+// mov reg, qword [base + index*scale + disp]
+static void emit_load(jit_emitter* e, int reg, int base, int index, int scale,
+                      int32_t disp) {
+    emit_rex(e, 1, reg, index, base);
+    e8(e, 0x8b);
+    emit_modrm_mem(e, reg, base, index, scale, disp);
+}
+
+// mov qword [base + index*scale + disp], reg
+static void emit_store(jit_emitter* e, int reg, int base, int index, int scale,
+                       int32_t disp) {
+    emit_rex(e, 1, reg, index, base);
+    e8(e, 0x89);
+    emit_modrm_mem(e, reg, base, index, scale, disp);
+}
+
+// movzx reg, byte/word [base + index] or mov reg, dword/qword [base + index]
+// for a load of `width`, or the store of reg's low bytes there.
+static void emit_narrow(jit_emitter* e, bool store, BYTE width, int reg,
+                        int base, int index) {
+    if (store && width == MEM_16) e8(e, 0x66);
+    emit_rex(e, width == MEM_CELL, reg, index, base);
+    if (store) {
+        e8(e, width == MEM_8 ? 0x88 : 0x89);
+    } else if (width == MEM_8 || width == MEM_16) {
+        e8(e, 0x0f);
+        e8(e, width == MEM_8 ? 0xb6 : 0xb7);
+    } else {
+        e8(e, 0x8b);
+    }
+    emit_modrm_mem(e, reg, base, index, 1, 0);
+}
+
+// movsx reg, word [base + disp]
+static void emit_load16s(jit_emitter* e, int reg, int base, int32_t disp) {
+    emit_rex(e, 1, reg, -1, base);
+    e8(e, 0x0f);
+    e8(e, 0xbf);
+    emit_modrm_mem(e, reg, base, -1, 1, disp);
+}
+
+// cmp reg, qword [base + disp]
+static void emit_cmp_mem(jit_emitter* e, int reg, int base, int32_t disp) {
+    emit_rex(e, 1, reg, -1, base);
+    e8(e, 0x3b);
+    emit_modrm_mem(e, reg, base, -1, 1, disp);
+}
+
+// mov word [base + disp], reg
+static void emit_store16(jit_emitter* e, int reg, int base, int32_t disp) {
+    e8(e, 0x66);
+    emit_rex(e, 0, reg, -1, base);
+    e8(e, 0x89);
+    emit_modrm_mem(e, reg, base, -1, 1, disp);
+}
+
+// mov word [base + disp], imm16
+static void emit_store16_imm(jit_emitter* e, int base, int32_t disp,
+                             uint16_t imm) {
+    e8(e, 0x66);
+    emit_rex(e, 0, 0, -1, base);
+    e8(e, 0xc7);
+    emit_modrm_mem(e, 0, base, -1, 1, disp);
+    e16(e, imm);
+}
+
+// <op> dst, src for the `op r/m64, r64` forms: add, or, and, xor, cmp,
+// test, mov.
+enum { OP_ADD = 0x01, OP_OR = 0x09, OP_AND = 0x21, OP_XOR = 0x31,
+       OP_CMP = 0x39, OP_TEST = 0x85, OP_MOV = 0x89 };
+
+static void emit_rr(jit_emitter* e, uint8_t op, int dst, int src) {
+    emit_rex(e, 1, src, -1, dst);
+    e8(e, op);
+    e8(e, 0xc0 | (src & 7) << 3 | (dst & 7));
+}
+
+static void emit_imul(jit_emitter* e, int dst, int src) {
+    emit_rex(e, 1, dst, -1, src);
+    e8(e, 0x0f);
+    e8(e, 0xaf);
+    e8(e, 0xc0 | (dst & 7) << 3 | (src & 7));
+}
+
+// Group 2/3 single-register forms: not = f7/2, neg = f7/3, shl cl = d3/4,
+// shr cl = d3/5.
+static void emit_group(jit_emitter* e, uint8_t op, int ext, int reg) {
+    emit_rex(e, 1, 0, -1, reg);
+    e8(e, op);
+    e8(e, 0xc0 | ext << 3 | (reg & 7));
+}
+
+static void emit_add_imm(jit_emitter* e, int reg, int32_t imm) {
+    emit_rex(e, 1, 0, -1, reg);
+    if (imm >= -128 && imm <= 127) {
+        e8(e, 0x83);
+        e8(e, 0xc0 | (reg & 7));
+        e8(e, (uint8_t)imm);
+    } else {
+        e8(e, 0x81);
+        e8(e, 0xc0 | (reg & 7));
+        e32(e, imm);
+    }
+}
+
+static void emit_mov_imm(jit_emitter* e, int reg, uint64_t imm) {
+    if (imm <= 0xffffffff) {
+        emit_rex(e, 0, 0, -1, reg);
+        e8(e, 0xb8 + (reg & 7));
+        e32(e, imm);
+    } else if ((int64_t)imm == (int32_t)imm) {
+        emit_rex(e, 1, 0, -1, reg);
+        e8(e, 0xc7);
+        e8(e, 0xc0 | (reg & 7));
+        e32(e, imm);
+    } else {
+        emit_rex(e, 1, 0, -1, reg);
+        e8(e, 0xb8 + (reg & 7));
+        e64(e, imm);
+    }
+}
+
+// rax = condition ? TRUE : FALSE, after a cmp.
+static void emit_set_flag(jit_emitter* e, uint8_t cc) {
+    e8(e, 0x0f); e8(e, 0x90 | cc); e8(e, 0xc0);    // setcc al
+    e8(e, 0x0f); e8(e, 0xb6); e8(e, 0xc0);         // movzx eax, al
+    emit_group(e, 0xf7, 3, X86_RAX);               // neg rax
+}
+
+static uint8_t* emit_jcc(jit_emitter* e, uint8_t cc) {
+    e8(e, 0x0f);
+    e8(e, 0x80 | cc);
+    e32(e, 0);
+    return e->p - 4;
+}
+
+static uint8_t* emit_jmp(jit_emitter* e) {
+    e8(e, 0xe9);
+    e32(e, 0);
+    return e->p - 4;
+}
+
+static void patch_rel32(uint8_t* rel, uint8_t* target) {
+    int32_t disp = (int32_t)(target - (rel + 4));
+    memcpy(rel, &disp, 4);
+}
+
+static void emit_push(jit_emitter* e, int reg) {
+    if (reg >= 8) e8(e, 0x41);
+    e8(e, 0x50 + (reg & 7));
+}
+
+static void emit_pop(jit_emitter* e, int reg) {
+    if (reg >= 8) e8(e, 0x41);
+    e8(e, 0x58 + (reg & 7));
+}
+
+// == VM operations
+
+static void add_exit(jit_emitter* e, uint8_t* rel, uint16_t retired,
+                     uint16_t eip, bool dynamic, bool flush) {
+    jit_exit* x = &e->exits[e->num_exits++];
+    x->rel = rel;
+    x->retired = retired;
+    x->eip = eip;
+    x->dynamic = dynamic;
+    x->flush = flush;
+}
+
+// DSTACK[SP + slot] / RSTACK[RSP + slot]
+static void emit_dstack_load(jit_emitter* e, int reg, int slot) {
+    emit_load(e, reg, REG_DSTACK, REG_SP, 8, slot * 8);
+}
+
+static void emit_dstack_store(jit_emitter* e, int reg, int slot) {
+    emit_store(e, reg, REG_DSTACK, REG_SP, 8, slot * 8);
+}
+
+static void emit_rstack_load(jit_emitter* e, int reg, int slot) {
+    emit_load(e, reg, REG_RSTACK, REG_RSP, 8, slot * 8);
+}
+
+static void emit_rstack_store(jit_emitter* e, int reg, int slot) {
+    emit_store(e, reg, REG_RSTACK, REG_RSP, 8, slot * 8);
+}
+
+static bool jit_supports(instruction ins) {
+    if (ins.lit.lit_f || ins.alu.op_type != OP_TYPE_ALU) return true;
+    return ins.alu.alu_op != ALU_IO_READ && ins.alu.out_mux != OUTPUT_IO_T &&
+           !INS_EXT(ins);
+}
+
+static bool alu_uses_n(instruction ins) {
+    if (ins.alu.in_mux == INPUT_N) return true;
+    switch (ins.alu.alu_op) {
+        case ALU_ADD: case ALU_AND: case ALU_OR: case ALU_XOR: case ALU_MUL:
+        case ALU_EQ: case ALU_GT: case ALU_U_GT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// r8 = *(uint64_t*)&code_map[min(T >> 1, 65536)] << 24, the code flags for
+// the five cells a store at T can touch; the padding past the last cell
+// reads as no code.
+static void emit_code_probe(jit_emitter* e, struct jit_state* jit) {
+    emit_rr(e, OP_MOV, X86_RCX, REG_T);
+    emit_rex(e, 1, 0, -1, X86_RCX);
+    e8(e, 0xd1); e8(e, 0xe9);                  // shr rcx, 1
+    emit_mov_imm(e, X86_RDX, 65536);
+    emit_rr(e, OP_CMP, X86_RCX, X86_RDX);
+    emit_rex(e, 1, X86_RCX, -1, X86_RDX);
+    e8(e, 0x0f); e8(e, 0x47); e8(e, 0xca);    // cmova rcx, rdx
+    emit_mov_imm(e, X86_RDI, (uint64_t)(uintptr_t)jit->code_map);
+    emit_load(e, X86_R8, X86_RDI, X86_RCX, 1, 0);
+    emit_rex(e, 1, 0, -1, X86_R8);
+    e8(e, 0xc1); e8(e, 0xe0); e8(e, 24);      // shl r8, 24
+}
+
+// Emits a load or store with a width, see `INS_NARROW()`.  The return
+// stack is left alone; a store leaves r8 as `emit_code_probe()` does.
+static void emit_alu_narrow(jit_emitter* e, struct jit_state* jit,
+                            instruction ins) {
+    bool store = ins.alu.out_mux == OUTPUT_MEM_T;
+    emit_load(e, X86_RCX, REG_CTX, -1, 1, OFF_MEMORY);
+    if (store) {
+        emit_dstack_load(e, X86_RAX, -2);
+        emit_narrow(e, true, INS_WIDTH(ins), X86_RAX, X86_RCX, REG_T);
+        emit_code_probe(e, jit);
+    } else {
+        emit_narrow(e, false, INS_WIDTH(ins), X86_RAX, X86_RCX, REG_T);
+    }
+    if (ins.alu.dstack) emit_add_imm(e, REG_SP, ins.alu.dstack);
+    if (ins.alu.dstack > 0) emit_dstack_store(e, REG_T, -2);
+    if (!store) {
+        emit_rr(e, OP_MOV, REG_T, X86_RAX);
+    } else if (ins.alu.dstack < 0) {
+        emit_dstack_load(e, REG_T, -1);
+    }
+}
+
+// Emits one ALU instruction.  If it copies R to EIP, the new EIP is left in
+// esi.  If it stores to memory, r8 is left holding the code flags for the
+// five cells the store can touch.
+static void emit_alu(jit_emitter* e, struct jit_state* jit, instruction ins) {
+    if (INS_NARROW(ins)) {
+        emit_alu_narrow(e, jit, ins);
+        return;
+    }
+    // rdx = N
+    if (alu_uses_n(ins)) {
+        emit_dstack_load(e, X86_RDX, -2);
+    }
+    // rax = IN
+    switch (ins.alu.in_mux) {
+        case INPUT_N: emit_rr(e, OP_MOV, X86_RAX, X86_RDX); break;
+        case INPUT_T: emit_rr(e, OP_MOV, X86_RAX, REG_T); break;
+        case INPUT_LOAD_T:
+            emit_load(e, X86_RCX, REG_CTX, -1, 1, OFF_MEMORY);
+            emit_load(e, X86_RAX, X86_RCX, REG_T, 1, 0);
+            break;
+        case INPUT_R: emit_rr(e, OP_MOV, X86_RAX, REG_R); break;
+    }
+    // rax = OUT
+    switch (ins.alu.alu_op) {
+        case ALU_IN: break;
+        case ALU_ADD: emit_rr(e, OP_ADD, X86_RAX, X86_RDX); break;
+        case ALU_T_N: emit_dstack_store(e, REG_T, -2); break;
+        case ALU_SWAP_IN:
+            emit_dstack_load(e, X86_RCX, -2);
+            emit_dstack_store(e, REG_T, -2);
+            emit_rr(e, OP_MOV, REG_T, X86_RCX);
+            break;
+        case ALU_AND: emit_rr(e, OP_AND, X86_RAX, X86_RDX); break;
+        case ALU_OR: emit_rr(e, OP_OR, X86_RAX, X86_RDX); break;
+        case ALU_XOR: emit_rr(e, OP_XOR, X86_RAX, X86_RDX); break;
+        case ALU_MUL: emit_imul(e, X86_RAX, X86_RDX); break;
+        case ALU_INVERT: emit_group(e, 0xf7, 2, X86_RAX); break;
+        case ALU_EQ:
+            emit_rr(e, OP_CMP, X86_RAX, X86_RDX);
+            emit_set_flag(e, CC_E);
+            break;
+        case ALU_GT:
+            emit_rr(e, OP_CMP, X86_RDX, X86_RAX);
+            emit_set_flag(e, CC_L);
+            break;
+        case ALU_U_GT:
+            emit_rr(e, OP_CMP, X86_RDX, X86_RAX);
+            emit_set_flag(e, CC_B);
+            break;
+        case ALU_RSHIFT:
+        case ALU_LSHIFT:
+            emit_rr(e, OP_MOV, X86_RCX, REG_T);
+            emit_group(e, 0xd3, ins.alu.alu_op == ALU_RSHIFT ? 5 : 4, X86_RAX);
+            break;
+        case ALU_LOAD:
+            emit_load(e, X86_RCX, REG_CTX, -1, 1, OFF_MEMORY);
+            emit_load(e, X86_RAX, X86_RCX, X86_RAX, 1, 0);
+            break;
+    }
+    if (ins.alu.r_eip) {
+        emit_rr(e, OP_MOV, X86_RSI, REG_R);
+    }
+    if (ins.alu.dstack) emit_add_imm(e, REG_SP, ins.alu.dstack);
+    if (ins.alu.rstack) emit_add_imm(e, REG_RSP, ins.alu.rstack);
+    if (ins.alu.dstack > 0) emit_dstack_store(e, REG_T, -2);
+    if (ins.alu.rstack > 0) emit_rstack_store(e, REG_R, -2);
+    switch (ins.alu.out_mux) {
+        case OUTPUT_T:
+            emit_rr(e, OP_MOV, REG_T, X86_RAX);
+            if (ins.alu.rstack < 0) emit_rstack_load(e, REG_R, -1);
+            break;
+        case OUTPUT_R:
+            emit_rr(e, OP_MOV, REG_R, X86_RAX);
+            if (ins.alu.dstack < 0) emit_dstack_load(e, REG_T, -1);
+            break;
+        case OUTPUT_MEM_T:
+            emit_load(e, X86_RCX, REG_CTX, -1, 1, OFF_MEMORY);
+            emit_store(e, X86_RAX, X86_RCX, REG_T, 1, 0);
+            emit_code_probe(e, jit);
+            if (ins.alu.dstack < 0) emit_dstack_load(e, REG_T, -1);
+            if (ins.alu.rstack < 0) emit_rstack_load(e, REG_R, -1);
+            break;
+    }
+}
+
+static void jit_flush(struct jit_state* jit) {
+    memset(jit->block_at, 0, sizeof(jit->block_at));
+    memset(jit->code_map, 0, sizeof(jit->code_map));
+    jit->used = 0;
+}
+
+static void* jit_compile(struct jit_state* jit, context* ctx, uint16_t start) {
+    if (!jit_supports(*(instruction*)&ctx->memory[start])) {
+        return jit->block_at[start] = JIT_INTERPRET;
+    }
+    if (jit->used + JIT_BLOCK_BYTES > JIT_CODE_SIZE) {
+        jit_flush(jit);
+    }
+
+    jit_emitter emitter = { .p = jit->code + jit->used, .num_exits = 0 };
+    jit_emitter* e = &emitter;
+    uint8_t* entry = e->p;
+
+    emit_push(e, X86_RBX);
+    emit_push(e, X86_RBP);
+    emit_push(e, X86_R12);
+    emit_push(e, X86_R13);
+    emit_push(e, X86_R14);
+    emit_push(e, X86_R15);
+    emit_rr(e, OP_MOV, REG_REGS, X86_RDI);
+    emit_load(e, REG_CTX, REG_REGS, -1, 1, offsetof(vm_regs, ctx));
+    emit_load(e, REG_DSTACK, REG_CTX, -1, 1, offsetof(context, DSTACK));
+    emit_load(e, REG_RSTACK, REG_CTX, -1, 1, offsetof(context, RSTACK));
+    emit_load(e, REG_T, REG_REGS, -1, 1, offsetof(vm_regs, T));
+    emit_load(e, REG_R, REG_REGS, -1, 1, offsetof(vm_regs, R));
+    emit_load16s(e, REG_SP, REG_REGS, offsetof(vm_regs, SP));
+    emit_load16s(e, REG_RSP, REG_REGS, offsetof(vm_regs, RSP));
+    emit_rr(e, OP_XOR, REG_CYCLES, REG_CYCLES);
+    uint8_t* body = e->p;
+
+    uint16_t pc = start;
+    uint16_t retired = 0;
+    bool open = true;
+    while (open) {
+        uint16_t raw = ctx->memory[pc];
+        instruction ins = *(instruction*)&raw;
+        if (!raw || !jit_supports(ins) || retired == JIT_BLOCK_MAX) {
+            add_exit(e, emit_jmp(e), retired, pc, false, false);
+            break;
+        }
+        jit->code_map[pc] = 1;
+        retired++;
+        uint16_t next = pc + 1;
+        if (ins.lit.lit_f) {
+            uint64_t lit = (uint64_t)ins.lit.lit_v <<
+                           (ins.lit.lit_shifts * LIT_BITS);
+            if (!ins.lit.lit_add) {
+                emit_dstack_store(e, REG_T, -1);
+                emit_add_imm(e, REG_SP, 1);
+                emit_mov_imm(e, REG_T, lit);
+            } else if (lit <= 0x7fffffff) {
+                emit_add_imm(e, REG_T, (int32_t)lit);
+            } else {
+                emit_mov_imm(e, X86_RAX, lit);
+                emit_rr(e, OP_ADD, REG_T, X86_RAX);
+            }
+        } else switch (ins.alu.op_type) {
+            case OP_TYPE_CJMP:
+                emit_rr(e, OP_MOV, X86_RAX, REG_T);
+                emit_add_imm(e, REG_SP, -1);
+                emit_dstack_load(e, REG_T, -1);
+                emit_rr(e, OP_TEST, X86_RAX, X86_RAX);
+                add_exit(e, emit_jcc(e, CC_E), retired, ins.jmp.target,
+                         false, false);
+                break;
+            case OP_TYPE_CALL:
+                emit_rstack_store(e, REG_R, -1);
+                emit_mov_imm(e, REG_R, (uint64_t)(int64_t)(int16_t)next);
+                emit_rstack_store(e, REG_R, 0);
+                emit_add_imm(e, REG_RSP, 1);
+                // fall through
+            case OP_TYPE_JMP:
+                if (ins.jmp.target == start) {
+                    emit_add_imm(e, REG_CYCLES, retired);
+                    emit_cmp_mem(e, REG_CYCLES, REG_REGS,
+                                 offsetof(vm_regs, budget));
+                    add_exit(e, emit_jcc(e, CC_AE), 0, start, false, false);
+                    patch_rel32(emit_jmp(e), body);
+                } else {
+                    add_exit(e, emit_jmp(e), retired, ins.jmp.target,
+                             false, false);
+                }
+                open = false;
+                break;
+            case OP_TYPE_ALU:
+                emit_alu(e, jit, ins);
+                if (ins.alu.r_eip) {
+                    add_exit(e, emit_jmp(e), retired, 0, true, false);
+                    open = false;
+                } else if (ins.alu.out_mux == OUTPUT_MEM_T) {
+                    emit_rr(e, OP_TEST, X86_R8, X86_R8);
+                    add_exit(e, emit_jcc(e, CC_NE), retired, next,
+                             false, true);
+                }
+                break;
+        }
+        pc = next;
+    }
+
+    // Exits, then the shared epilogue they all jump to.
+    uint8_t* to_epilogue[JIT_BLOCK_MAX * 2 + 2];
+    for (int idx = 0; idx < e->num_exits; idx++) {
+        jit_exit* x = &e->exits[idx];
+        patch_rel32(x->rel, e->p);
+        emit_add_imm(e, REG_CYCLES, x->retired);
+        if (x->flush) {
+            emit_rex(e, 1, 0, -1, REG_CYCLES);
+            e8(e, 0x0f); e8(e, 0xba);
+            e8(e, 0xe8 | (REG_CYCLES & 7)); e8(e, 63);  // bts r11, 63
+        }
+        if (x->dynamic) {
+            emit_store16(e, X86_RSI, REG_REGS, offsetof(vm_regs, EIP));
+        } else {
+            emit_store16_imm(e, REG_REGS, offsetof(vm_regs, EIP), x->eip);
+        }
+        to_epilogue[idx] = emit_jmp(e);
+    }
+    for (int idx = 0; idx < e->num_exits; idx++) {
+        patch_rel32(to_epilogue[idx], e->p);
+    }
+    emit_store(e, REG_T, REG_REGS, -1, 1, offsetof(vm_regs, T));
+    emit_store(e, REG_R, REG_REGS, -1, 1, offsetof(vm_regs, R));
+    emit_store16(e, REG_SP, REG_REGS, offsetof(vm_regs, SP));
+    emit_store16(e, REG_RSP, REG_REGS, offsetof(vm_regs, RSP));
+    emit_rr(e, OP_MOV, X86_RAX, REG_CYCLES);
+    emit_pop(e, X86_R15);
+    emit_pop(e, X86_R14);
+    emit_pop(e, X86_R13);
+    emit_pop(e, X86_R12);
+    emit_pop(e, X86_RBP);
+    emit_pop(e, X86_RBX);
+    e8(e, 0xc3);
+
+    jit->used = e->p - jit->code;
+    return jit->block_at[start] = entry;
+}
+
+static struct jit_state* jit_state(context *ctx) {
+    if (!ctx->jit) {
+        struct jit_state* jit = calloc(1, sizeof(struct jit_state));
+        jit->code = mmap(NULL, JIT_CODE_SIZE,
+                         PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (jit->code == MAP_FAILED) {
+            free(jit);
+            return NULL;
+        }
+        ctx->jit = jit;
+    }
+    return ctx->jit;
+}
+
+void vm_jit_invalidate(context *ctx, uint32_t addr, uint32_t count) {
+    struct jit_state* jit = ctx->jit;
+    if (!jit) return;
+    for (uint32_t idx = 0; idx < count && addr + idx < 65536; idx++) {
+        if (jit->code_map[addr + idx] ||
+            jit->block_at[addr + idx] == JIT_INTERPRET) {
+            jit_flush(jit);
+            return;
+        }
+    }
+}
+
+void vm_jit_release(context *ctx) {
+    struct jit_state* jit = ctx->jit;
+    if (!jit) return;
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+    ctx->jit = NULL;
+}
+
+int vm_jit(context *ctx) {
+    struct jit_state* jit = jit_state(ctx);
+    if (!jit) {
+        // No executable memory to be had; interpret instead.
+        return vm_generated(ctx);
+    }
+    vm_regs r = {
+            .ctx = ctx,
+            .T = ctx->DSTACK[ctx->SP-1],
+            .R = ctx->RSTACK[ctx->RSP-1],
+            .EIP = ctx->EIP,
+            .SP = ctx->SP,
+            .RSP = ctx->RSP };
+    uint64_t cycles = ctx->CYCLES;
+    uint64_t limit = ctx->CYCLE_LIMIT;
+    uint16_t raw;
+
+    while ((raw = ctx->memory[(uint16_t)r.EIP]) && cycles < limit) {
+        void* block = jit->block_at[(uint16_t)r.EIP];
+        if (!block) {
+            block = jit_compile(jit, ctx, r.EIP);
+        }
+        if (block == JIT_INTERPRET) {
+            instruction ins = *(instruction*)&raw;
+            bool store = !ins.lit.lit_f && ins.alu.op_type == OP_TYPE_ALU &&
+                         ins.alu.out_mux == OUTPUT_MEM_T;
+            uint64_t cell = (uint64_t)r.T >> 1;
+#ifdef DEBUG
+            print_state(ctx, r.RSP, r.SP, r.EIP, r.R, r.T);
+#endif // DEBUG
+            r.EIP++;
+            cycles++;
+            VM_HANDLERS[raw](&r, raw);
+            if (store && cell < 65536) {
+                vm_jit_invalidate(ctx, cell, 5);
+            }
+        } else {
+            r.budget = limit - cycles;
+            uint64_t retired = ((jit_block)block)(&r);
+            if (retired & JIT_FLUSH) {
+                jit_flush(jit);
+            }
+            cycles += retired & ~JIT_FLUSH;
+        }
+    }
+#ifdef DEBUG
+    print_state(ctx, r.RSP, r.SP, r.EIP, r.R, r.T);
+#endif
+    ctx->CYCLES = cycles;
+    ctx->DSTACK[r.SP-1] = r.T;
+    ctx->RSTACK[r.RSP-1] = r.R;
+    ctx->SP = r.SP;
+    ctx->RSP = r.RSP;
+    ctx->EIP = r.EIP;
+    vm_out_flush(ctx);
+    return raw ? VM_PREEMPTED : VM_HALTED;
+}
+
+#else
+
+// Not an x86-64 host: interpret.
+void vm_jit_invalidate(context *ctx, uint32_t addr, uint32_t count) {
+}
+
+void vm_jit_release(context *ctx) {
+}
+
+int vm_jit(context *ctx) {
+    return vm_generated(ctx);
+}
+
+#endif // __x86_64__
@@ -0,0 +1,145 @@
+//
+// vm_memory.c - the memory a context's code and data live in.
+//
+// Memory is an anonymous mapping, reserved lazily, so a context can be
+// given gigabytes and only pays for the pages it touches.  Code stays in
+// the first `VM_CODE_CELLS` cells, where jumps and calls reach; `@` and `!`
+// take 64-bit byte addresses and reach all of it.  As with the stacks,
+// engines don't check addresses: a load or store past the end faults.
+//
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "vm.h"
+
+// The huge page size `VM_MEMORY_HUGE` rounds mappings up to.
+#define MEMORY_HUGE_PAGE (2 << 20)
+
+static void* memory_map(uint64_t bytes, int flags) {
+    void *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // Reserved up front: an unreserved huge page that can't be had when
+    // first touched is a SIGBUS.
+    if (flags & VM_MEMORY_HUGE) {
+        memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif // MAP_HUGETLB
+    if (memory == MAP_FAILED) {
+        memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+#ifdef MADV_HUGEPAGE
+        if (memory != MAP_FAILED && (flags & VM_MEMORY_HUGE)) {
+            madvise(memory, bytes, MADV_HUGEPAGE);
+        }
+#endif // MADV_HUGEPAGE
+    }
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+// Give `ctx` at least `bytes` of memory, and never less than
+// `VM_MEMORY_BYTES`, keeping what it already holds up to the new size.
+// Returns false, leaving `ctx` as it was, if it can't be mapped.
+bool vm_memory(context *ctx, uint64_t bytes, int flags) {
+    uint64_t page = (flags & VM_MEMORY_HUGE) ? MEMORY_HUGE_PAGE
+                                             : sysconf(_SC_PAGESIZE);
+    if (bytes < VM_MEMORY_BYTES) bytes = VM_MEMORY_BYTES;
+    if (bytes > UINT64_MAX - page) return false;
+    bytes = (bytes + page - 1) / page * page;
+    uint16_t *memory = memory_map(bytes, flags);
+    if (!memory) {
+        return false;
+    }
+    if (ctx->memory) {
+        memcpy(memory, ctx->memory,
+               ctx->MEMORY_BYTES < bytes ? ctx->MEMORY_BYTES : bytes);
+        vm_memory_release(ctx);
+    }
+    ctx->memory = memory;
+    ctx->MEMORY_BYTES = bytes;
+    return true;
+}
+
+// Is [addr, addr+len) inside `ctx`'s memory?
+static bool memory_range(context *ctx, uint64_t addr, uint64_t len) {
+    return addr <= ctx->MEMORY_BYTES && len <= ctx->MEMORY_BYTES - addr;
+}
+
+// Copy `len` bytes one at a time in the order `up` gives, as `cmove` and
+// `cmove>` are defined to, so an overlapping copy repeats the bytes it has
+// already written.  Each pass copies at most the overlap's distance, which
+// memcpy can do in one go.
+static void memory_copy(uint8_t *from, uint8_t *to, uint64_t len, bool up) {
+    if (up ? to <= from : to >= from) {
+        memmove(to, from, len);
+        return;
+    }
+    uint64_t step = up ? to - from : from - to;
+    for (uint64_t done = 0; done < len; ) {
+        uint64_t part = len - done < step ? len - done : step;
+        if (up) {
+            memcpy(to + done, from + done, part);
+        } else {
+            memcpy(to + len - done - part, from + len - done - part, part);
+        }
+        done += part;
+    }
+}
+
+// The bulk memory operations of `vm_ext()`.  Any range that isn't wholly
+// inside memory is left alone, and compares as if empty.  Writes to code
+// cells drop whatever was decoded or compiled from them, and writes to an
+// indexed header drop the dictionary index.
+int16_t vm_ext_memory(context *ctx, uint8_t op, int16_t SP) {
+    int64_t *S = ctx->DSTACK;
+    uint8_t *memory = (uint8_t*)ctx->memory;
+    switch (op) {
+        case EXT_CMOVE:
+        case EXT_CMOVE_UP:
+        case EXT_MOVE:
+        case EXT_FILL: {
+            uint64_t to = op == EXT_FILL ? S[SP-3] : S[SP-2];
+            uint64_t len = op == EXT_FILL ? S[SP-2] : S[SP-1];
+            if (!memory_range(ctx, to, len)) break;
+            if (op == EXT_FILL) {
+                memset(memory + to, (uint8_t)S[SP-1], len);
+            } else if (!memory_range(ctx, S[SP-3], len)) {
+                break;
+            } else if (op == EXT_MOVE) {
+                memmove(memory + to, memory + S[SP-3], len);
+            } else {
+                memory_copy(memory + S[SP-3], memory + to, len,
+                            op == EXT_CMOVE);
+            }
+            uint64_t end = (to + len + 1) >> 1;
+            if (len && to >> 1 < VM_CODE_CELLS) {
+                if (end > VM_CODE_CELLS) end = VM_CODE_CELLS;
+                vm_invalidate_code(ctx, to >> 1, end - (to >> 1));
+                vm_dict_invalidate(ctx, to, len);
+            }
+            break;
+        }
+        case EXT_COMPARE: {
+            uint64_t len1 = memory_range(ctx, S[SP-4], S[SP-3]) ? S[SP-3] : 0;
+            uint64_t len2 = memory_range(ctx, S[SP-2], S[SP-1]) ? S[SP-1] : 0;
+            int order = memcmp(memory + (len1 ? S[SP-4] : 0),
+                               memory + (len2 ? S[SP-2] : 0),
+                               len1 < len2 ? len1 : len2);
+            if (!order) order = (len1 > len2) - (len1 < len2);
+            S[SP-4] = order < 0 ? -1 : order > 0;
+            return SP - 3;
+        }
+    }
+    return SP - 3;
+}
+
+void vm_memory_release(context *ctx) {
+    if (ctx->memory) {
+        munmap(ctx->memory, ctx->MEMORY_BYTES);
+    }
+    ctx->memory = NULL;
+    ctx->MEMORY_BYTES = 0;
+}
@@ -37,6 +37,18 @@ bool lookup_field(const char* word, instruction* lookup) {
     return(false);
 }
 
+// The `ext:` field for extended op `ins`, or NULL if it has none.
+static const char* lookup_ext_field(instruction ins) {
+    ins.alu.op_type = 0;
+    for (int idx = 0; strlen(INS_FIELDS[idx].repr); idx++) {
+        if (INS_FIELDS[idx].type == INPUT &&
+            *(uint16_t*)&INS_FIELDS[idx].ins[0] == *(uint16_t*)&ins) {
+            return INS_FIELDS[idx].repr;
+        }
+    }
+    return NULL;
+}
+
 bool is_term(const char* word) {
     int idx = 0;
     while (strlen(INS_FIELDS[idx].repr)) {
@@ -154,7 +166,7 @@ bool init_opcodes(word_node* opcodes) {
         bool string = false;
 
         // Loop through the characters in our buffer.
-        for(int i=0; i<=input_len; i++) {
+        for(int i=0; i<input_len; i++) {
            if (input[i]==' ' || input[i] == '\0') {
                 // We replace spaces with null bytes to indicate to C that it's
                 // the termination of the string.
@@ -242,12 +254,30 @@ char* instruction_to_str(instruction ins) {
             const char* alu_ops_repr = ALU_OPS_REPR[ins.alu.alu_op];
             const char* dstack_repr = DSTACK_REPR[dstack_idx];
             const char* rstack_repr = RSTACK_REPR[rstack_idx];
+            // The rstack bits of a narrow load or store are its width.
+            if (INS_NARROW(ins)) {
+                input_mux = MEM_WIDTH_REPR[INS_WIDTH(ins)];
+                alu_ops_repr = "";
+                rstack_repr = RSTACK_REPR[0];
+            }
+            // An extended op's field stands for all but its class.
+            const char* ext = INS_EXT(ins) ? lookup_ext_field(ins) : NULL;
+            if (ext) {
+                input_mux = ext;
+                alu_ops_repr = "";
+                output_mux = OUTPUT_MUX_REPR[0];
+                dstack_repr = DSTACK_REPR[0];
+                rstack_repr = RSTACK_REPR[0];
+            }
             const char* class_repr = OP_TYPE_REPR[ins.alu.op_type];
 
+            // An `ext:` field runs on into the ALU column.
+            char in_alu[40];
+            snprintf(in_alu, sizeof(in_alu), "%-7s %s",
+                     input_mux, alu_ops_repr);
             asprintf(&ret_str,
-                     "        %-7s %-9s %-7s %-6s %-4s %-4s %-7s",
-                     input_mux,
-                     alu_ops_repr,
+                     "        %-17s %-7s %-6s %-4s %-4s %-7s",
+                     in_alu,
                      output_mux,
                      dstack_repr,
                      rstack_repr,
@@ -38,6 +38,11 @@ static char* OUTPUT_MUX_REPR[] = {
         "->T", "->R", "->io[T]", "->[T]"
 };
 
+// === MEM_WIDTH: the `[T]` of a narrow load or store, by width.
+static char* MEM_WIDTH_REPR[] = {
+        "[T]->IN", "[T]32", "[T]16", "[T]8"
+};
+
 // === Representation of various flags
 static char* LIT_SHIFT_REPR[] = {
         "", "imm<<12", "imm<<24", "imm<<36"
@@ -71,12 +76,57 @@ typedef struct {
     uint8_t        ins_ct;
 } forth_op;
 
+// The input field for extended operation `op`, which fills every field of an
+// ALU instruction but its class; a 2-bit stack field holds 2 and 3 as -2 and
+// -1.
+#define EXT_BITS(v) ((((v) & 3) ^ 2) - 2)
+#define EXT_FIELD(repr, op)                                                 \
+        {repr, INPUT, {{.alu.in_mux = INPUT_T,                              \
+                        .alu.alu_op = ALU_LSHIFT,                           \
+                        .alu.out_mux = (op) >> 4,                           \
+                        .alu.dstack = EXT_BITS((op) >> 2),                  \
+                        .alu.rstack = EXT_BITS(op)}}}
+
 static forth_op INS_FIELDS[] = {
         {"input_mux",  COMMT, {{}}},
         {"N->IN",      INPUT, {{.alu.in_mux = INPUT_N}}},
         {"T->IN",      INPUT, {{.alu.in_mux = INPUT_T}}},
         {"[T]->IN",    INPUT, {{.alu.in_mux = INPUT_LOAD_T}}},
         {"R->IN",      INPUT, {{.alu.in_mux = INPUT_R}}},
+        // Narrow loads and stores, see `INS_NARROW()`.
+        {"[T]8",       INPUT, {{.alu.in_mux = INPUT_T,
+                                .alu.alu_op = ALU_LOAD,
+                                .alu.rstack = -1}}},
+        {"[T]16",      INPUT, {{.alu.in_mux = INPUT_T,
+                                .alu.alu_op = ALU_LOAD,
+                                .alu.rstack = -2}}},
+        {"[T]32",      INPUT, {{.alu.in_mux = INPUT_T,
+                                .alu.alu_op = ALU_LOAD,
+                                .alu.rstack = 1}}},
+        // Extended operations, see `INS_EXT()`.
+        EXT_FIELD("ext:um*",      EXT_UM_MUL),
+        EXT_FIELD("ext:m*",       EXT_M_MUL),
+        EXT_FIELD("ext:um/mod",   EXT_UM_MOD),
+        EXT_FIELD("ext:sm/rem",   EXT_SM_REM),
+        EXT_FIELD("ext:u/mod",    EXT_U_DIV_MOD),
+        EXT_FIELD("ext:/mod",     EXT_DIV_MOD),
+        EXT_FIELD("ext:popcount", EXT_POPCOUNT),
+        EXT_FIELD("ext:clz",      EXT_CLZ),
+        EXT_FIELD("ext:ctz",      EXT_CTZ),
+        EXT_FIELD("ext:min",      EXT_MIN),
+        EXT_FIELD("ext:max",      EXT_MAX),
+        EXT_FIELD("ext:umin",     EXT_UMIN),
+        EXT_FIELD("ext:umax",     EXT_UMAX),
+        EXT_FIELD("ext:arshift",  EXT_ARSHIFT),
+        EXT_FIELD("ext:rol",      EXT_ROL),
+        EXT_FIELD("ext:ror",      EXT_ROR),
+        EXT_FIELD("ext:bswap",    EXT_BSWAP),
+        EXT_FIELD("ext:cmove",    EXT_CMOVE),
+        EXT_FIELD("ext:cmove>",   EXT_CMOVE_UP),
+        EXT_FIELD("ext:move",     EXT_MOVE),
+        EXT_FIELD("ext:fill",     EXT_FILL),
+        EXT_FIELD("ext:compare",  EXT_COMPARE),
+        EXT_FIELD("ext:search",   EXT_SEARCH_WORDLIST),
         {"alu_op",     COMMT, {{}}},
         {"IN->",       FIELD, {{.alu.alu_op = ALU_IN }}},
         {"T<>N,IN->",  FIELD, {{.alu.alu_op = ALU_SWAP_IN }}},
@@ -213,6 +263,35 @@ static forth_define FORTH_OPS[] = {
         {"over=",   "       T->IN   IN==N      ->T                 alu"},
         {"swap>r",  "       N->IN   T->N,IN->  ->R       d-1  r+1  alu"},
         {"swapr>",  "       R->IN   T<>N,IN->  ->T       d+1  r-1  alu"},
+        {"c@",      "       [T]8               ->T                 alu"},
+        {"c!",      "       [T]8               ->[T]     d-2       alu"},
+        {"w@",      "       [T]16              ->T                 alu"},
+        {"w!",      "       [T]16              ->[T]     d-2       alu"},
+        {"l@",      "       [T]32              ->T                 alu"},
+        {"l!",      "       [T]32              ->[T]     d-2       alu"},
+        {"um*",     "       ext:um*                                alu"},
+        {"m*",      "       ext:m*                                 alu"},
+        {"um/mod",  "       ext:um/mod                             alu"},
+        {"sm/rem",  "       ext:sm/rem                             alu"},
+        {"u/mod",   "       ext:u/mod                              alu"},
+        {"/mod",    "       ext:/mod                               alu"},
+        {"popcount", "      ext:popcount                           alu"},
+        {"clz",     "       ext:clz                                alu"},
+        {"ctz",     "       ext:ctz                                alu"},
+        {"min",     "       ext:min                                alu"},
+        {"max",     "       ext:max                                alu"},
+        {"umin",    "       ext:umin                               alu"},
+        {"umax",    "       ext:umax                               alu"},
+        {"arshift", "       ext:arshift                            alu"},
+        {"rol",     "       ext:rol                                alu"},
+        {"ror",     "       ext:ror                                alu"},
+        {"bswap",   "       ext:bswap                              alu"},
+        {"cmove",   "       ext:cmove                              alu"},
+        {"cmove>",  "       ext:cmove>                             alu"},
+        {"move",    "       ext:move                               alu"},
+        {"fill",    "       ext:fill                               alu"},
+        {"compare", "       ext:compare                            alu"},
+        {"search-wordlist", "ext:search                             alu"},
         {"1+",      "1      imm+                                   imm"},
         {"2+",      "2      imm+                                   imm"},
         {"2*",      "1                                             imm lshift", CODE},
@@ -245,14 +324,15 @@ static forth_define FORTH_OPS[] = {
         {"lo16",    "48 imm lshift 48 imm rshift", CODE},
         {">><<",    "tuck rshift swap lshift", CODE},
         {"nmask8",  "255 imm invert", CODE},
-        {"w@",      "@ lo16", CODE},
-        {"c@",      ">r @r 255 imm and r> 256 imm and or", CODE},
-        {"c!",      ">r 255 imm and @r nmask8 and or r> !", CODE},
         {"nmask16",  "0 imm invert 16 imm lshift", CODE},
-        {"w!",      ">r lo16 r@ @ nmask16 and or r> !", CODE},
         {"2w@",     "dup w@ swap 2+ w@", CODE},
-        {"2w!",     ">r 16 imm lshift or r@ @ 0 imm invert 32 imm lshift and or r> !", CODE},
-        {".s",      "0 imm 224 imm io!", CODE}};
+        {"2w!",     ">r 16 imm lshift or r> l!", CODE},
+        {"/",       "/mod nip", CODE},
+        {"mod",     "/mod drop", CODE},
+        {"*/mod",   ">r m* r> sm/rem", CODE},
+        {"*/",      "*/mod nip", CODE},
+        {".s",      "0 imm 224 imm io!", CODE},
+        {"",        ""}};
 
 // Instructions associated with string representations.
 typedef struct {
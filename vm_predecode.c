@@ -0,0 +1,594 @@
+//
+// vm_predecode.c - threaded engine running from a pre-decoded side array.
+//
+// Each code cell is decoded once into a `predecoded` record holding the
+// handler label to jump to and the fields that handler needs: the literal
+// already shifted into place, or the jump target, or the ALU stack deltas
+// and stage selectors.  The engine then never touches the instruction
+// bitfields.
+//
+// Records start out pointing at the `decode` handler, which decodes the
+// cell the first time it is executed.  `vm_predecode()` decodes the whole
+// image up front, and memory writes by the engine put the cells they cover
+// back to `decode`.  Code that writes `ctx->memory` from outside the engine
+// after the table exists must call `vm_invalidate_code()`.
+//
+// The fused engine runs the same handlers, but decoding also looks at the
+// next cell and turns a few hot pairs into one superinstruction record:
+// a literal followed by a binary ALU op that consumes it (`lit +`,
+// `lit and`, `lit =`, ...), and `dup 0branch`.  A superinstruction retires
+// both instructions, so `ctx->CYCLES` counts the same as unfused, and the
+// second cell keeps its own record for code that jumps straight to it.
+// Fused records are valid for either engine, so the table can be shared.
+//
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "vm.h"
+#include "vm_instruction.h"
+#include "vm_constants.h"
+#ifdef DEBUG
+#include "vm_debug.h"
+#include "vm_opcodes.h"
+#endif // DEBUG
+
+#define PREDECODE_CELLS 65536
+
+#if defined(__GNUC__)
+
+struct predecoded {
+    void* handler;
+    union {
+        int64_t lit;            // literal, already shifted
+        uint16_t target;        // jump and call target
+        struct {
+            SBYTE   dstack;
+            SBYTE   rstack;         // the width, for narrow loads and stores
+            BYTE    alu_op;         // the operation, for extended ops
+            BYTE    out_mux;
+            bool    r_eip;
+        } alu;                  // ALU; `handler` is the `in_mux` stage
+    };
+};
+
+// Handler labels published by `vm_predecoded(NULL)`.
+static struct {
+    void* lit;
+    void* lit_add;
+    void* jmp;
+    void* cjmp;
+    void* call;
+    void* halt;
+    void* decode;
+    void* in_mux[4];
+    void* in_mux_ret[4];        // the same for ALU ops that set EIP from R
+    void* narrow_load;          // `INS_NARROW()`, `->[T]` or not
+    void* narrow_store;
+    void* ext;                  // `INS_EXT()`
+    void* lit_alu[16];          // `lit` fused with the ALU op; NULL if none
+    void* dup_cjmp;
+} handlers;
+
+static void predecode_cell(struct predecoded* rec, uint16_t cell) {
+    instruction ins = *(instruction*)&cell;
+    if (!cell) {
+        rec->handler = handlers.halt;
+    } else if (ins.lit.lit_f) {
+        rec->handler = ins.lit.lit_add ? handlers.lit_add : handlers.lit;
+        rec->lit = (int64_t)((uint64_t)ins.lit.lit_v <<
+                             (ins.lit.lit_shifts * LIT_BITS));
+    } else if (ins.alu.op_type == OP_TYPE_ALU) {
+        rec->handler = ins.alu.r_eip ? handlers.in_mux_ret[ins.alu.in_mux] :
+                                       handlers.in_mux[ins.alu.in_mux];
+        if (INS_NARROW(ins)) {
+            rec->handler = ins.alu.out_mux == OUTPUT_MEM_T ?
+                           handlers.narrow_store : handlers.narrow_load;
+        }
+        rec->alu.dstack = ins.alu.dstack;
+        rec->alu.rstack = ins.alu.rstack;
+        rec->alu.alu_op = ins.alu.alu_op;
+        if (INS_EXT(ins)) {
+            rec->handler = handlers.ext;
+            rec->alu.alu_op = INS_EXT_OP(ins);
+        }
+        rec->alu.out_mux = ins.alu.out_mux;
+        rec->alu.r_eip = ins.alu.r_eip;
+    } else {
+        rec->handler = ins.jmp.op_type == OP_TYPE_JMP ? handlers.jmp :
+                       ins.jmp.op_type == OP_TYPE_CJMP ? handlers.cjmp :
+                       handlers.call;
+        rec->target = ins.jmp.target;
+    }
+}
+
+// Fuse `cell` with the `next` one if they form a superinstruction.
+static bool predecode_fuse(struct predecoded* rec, uint16_t cell,
+                           uint16_t next) {
+    instruction ins = *(instruction*)&cell;
+    instruction nxt = *(instruction*)&next;
+    if (ins.lit.lit_f || nxt.lit.lit_f) {
+        if (!ins.lit.lit_f || ins.lit.lit_add || nxt.lit.lit_f ||
+            nxt.alu.op_type != OP_TYPE_ALU) {
+            return false;
+        }
+        // The op must take the literal as IN and the old T as N, and
+        // leave its result in T with nothing else touched.
+        if (nxt.alu.in_mux != INPUT_T || nxt.alu.dstack != -1 ||
+            nxt.alu.rstack != 0 || nxt.alu.out_mux != OUTPUT_T ||
+            nxt.alu.r_eip || !handlers.lit_alu[nxt.alu.alu_op]) {
+            return false;
+        }
+        rec->handler = handlers.lit_alu[nxt.alu.alu_op];
+        rec->lit = (int64_t)((uint64_t)ins.lit.lit_v <<
+                             (ins.lit.lit_shifts * LIT_BITS));
+        return true;
+    }
+    // `dup`: T->IN, IN->, ->T, d+1.
+    if (ins.alu.op_type == OP_TYPE_ALU && ins.alu.in_mux == INPUT_T &&
+        ins.alu.alu_op == ALU_IN && ins.alu.out_mux == OUTPUT_T &&
+        ins.alu.dstack == 1 && ins.alu.rstack == 0 && !ins.alu.r_eip &&
+        nxt.alu.op_type == OP_TYPE_CJMP) {
+        rec->handler = handlers.dup_cjmp;
+        rec->target = nxt.jmp.target;
+        return true;
+    }
+    return false;
+}
+
+static void predecode_at(context *ctx, struct predecoded* rec, uint16_t addr) {
+    if (ctx->engine == ENGINE_FUSED &&
+        predecode_fuse(rec, ctx->memory[addr],
+                       ctx->memory[(uint16_t)(addr + 1)])) {
+        return;
+    }
+    predecode_cell(rec, ctx->memory[addr]);
+}
+
+static struct predecoded* predecode_table(context *ctx) {
+    if (!handlers.decode) {
+        vm_predecoded(NULL);
+    }
+    if (!ctx->decoded) {
+        ctx->decoded = malloc(sizeof(struct predecoded) * PREDECODE_CELLS);
+        vm_predecode_invalidate(ctx, 0, PREDECODE_CELLS);
+    }
+    return ctx->decoded;
+}
+
+void vm_predecode(context *ctx) {
+    struct predecoded* decoded = predecode_table(ctx);
+    for (int addr = 0; addr < PREDECODE_CELLS; addr++) {
+        predecode_at(ctx, &decoded[addr], addr);
+    }
+}
+
+void vm_predecode_invalidate(context *ctx, uint32_t addr, uint32_t count) {
+    if (!ctx->decoded) return;
+    for (uint32_t idx = 0; idx < count && addr + idx < PREDECODE_CELLS; idx++) {
+        ctx->decoded[addr + idx].handler = handlers.decode;
+    }
+    // The cell before may have been fused with the first one.
+    if (count) {
+        ctx->decoded[(uint16_t)(addr - 1)].handler = handlers.decode;
+    }
+}
+
+#ifdef DEBUG
+#define TRACE() print_state(ctx, RSP, SP, EIP, R, T)
+#else
+#define TRACE()
+#endif // DEBUG
+
+// Trace the second half of a superinstruction whose first half pushed `X`.
+#ifdef DEBUG
+#define TRACE_PUSHED(X) do {                        \
+        ctx->DSTACK[SP-1] = T;                      \
+        print_state(ctx, RSP, SP + 1, EIP, R, (X)); \
+    } while (0)
+#else
+#define TRACE_PUSHED(X)
+#endif // DEBUG
+
+#define DISPATCH() do {                             \
+        rec = &decoded[(uint16_t)EIP];              \
+        goto *rec->handler;                         \
+    } while (0)
+
+// Every handler except `halt`, `decode` and the superinstructions retires
+// one instruction.
+#define STEP() do {                                 \
+        TRACE();                                    \
+        EIP++;                                      \
+        cycles++;                                   \
+    } while (0)
+
+// Retire both halves of a superinstruction whose first half pushes `X`.
+#define STEP_PAIR(X) do {                           \
+        STEP();                                     \
+        TRACE_PUSHED(X);                            \
+        EIP++;                                      \
+        cycles++;                                   \
+    } while (0)
+
+// A store at byte address `ADDR` covers up to five cells, any of which may
+// be code, and the cell before them may have been fused with the first.
+// Stores above the code cells can't touch any.
+#define STORE_INVALIDATE(ADDR) do {                 \
+        uint64_t at = (uint64_t)(ADDR);             \
+        if (at < PREDECODE_CELLS * sizeof(uint16_t)) { \
+            decoded[(uint16_t)((at >> 1) - 1)].handler = &&decode; \
+            for (uint64_t cell = at >> 1; cell <= (at + 7) >> 1; cell++) { \
+                decoded[(uint16_t)cell].handler = &&decode; \
+            }                                       \
+        }                                           \
+    } while (0)
+
+// A taken branch or call can end a budgeted run.
+#define BUDGET_CHECK() do {                         \
+        if (cycles >= limit) goto preempted;        \
+    } while (0)
+
+// So can a return, before it runs, unless nothing has run yet.
+#define RET_BUDGET_CHECK() do {                     \
+        if (cycles >= limit && cycles > start)      \
+            goto preempted;                         \
+    } while (0)
+
+// Called with NULL, only publishes the handler labels to `handlers`.
+int vm_predecoded(context *ctx) {
+    if (!ctx) {
+        handlers.lit = &&op_lit;
+        handlers.lit_add = &&op_lit_add;
+        handlers.jmp = &&op_jmp;
+        handlers.cjmp = &&op_cjmp;
+        handlers.call = &&op_call;
+        handlers.halt = &&halt;
+        handlers.decode = &&decode;
+        handlers.in_mux[INPUT_N] = &&in_n;
+        handlers.in_mux[INPUT_T] = &&in_t;
+        handlers.in_mux[INPUT_LOAD_T] = &&in_load_t;
+        handlers.in_mux[INPUT_R] = &&in_r;
+        handlers.in_mux_ret[INPUT_N] = &&ret_n;
+        handlers.in_mux_ret[INPUT_T] = &&ret_t;
+        handlers.in_mux_ret[INPUT_LOAD_T] = &&ret_load_t;
+        handlers.in_mux_ret[INPUT_R] = &&ret_r;
+        handlers.narrow_load = &&narrow_load;
+        handlers.narrow_store = &&narrow_store;
+        handlers.ext = &&ext;
+        handlers.lit_alu[ALU_ADD] = &&lit_add_n;
+        handlers.lit_alu[ALU_AND] = &&lit_and_n;
+        handlers.lit_alu[ALU_OR] = &&lit_or_n;
+        handlers.lit_alu[ALU_XOR] = &&lit_xor_n;
+        handlers.lit_alu[ALU_MUL] = &&lit_mul_n;
+        handlers.lit_alu[ALU_EQ] = &&lit_eq_n;
+        handlers.lit_alu[ALU_GT] = &&lit_gt_n;
+        handlers.lit_alu[ALU_U_GT] = &&lit_u_gt_n;
+        handlers.dup_cjmp = &&dup_cjmp;
+        return 0;
+    }
+
+    register int16_t EIP = ctx->EIP;        // EIP = execution pointer
+    register int16_t SP = ctx->SP;          // SP = data stack pointer
+    register int16_t RSP = ctx->RSP;        // RSP = return stack pointer
+    register int64_t T = ctx->DSTACK[SP-1]; // T = Top Of Stack / TOS
+    register int64_t R = ctx->RSTACK[RSP-1]; // R = Top Of Return Stack / TOR
+    register int64_t IN = 0;                // I = input to ALU
+    register int64_t N;                     // N = Next on Stack / NOS
+    register int64_t OUT = 0;               // OUT - result from ALU
+    register uint64_t cycles = ctx->CYCLES; // how many instructions processed
+    uint64_t limit = ctx->CYCLE_LIMIT;      // stop at a branch past this
+    uint64_t start = cycles;                // the first always runs
+    int status = VM_HALTED;
+    struct predecoded* decoded = predecode_table(ctx);
+    register struct predecoded* rec;
+
+    static void* const alu_op[16] = {
+            [ALU_IN] = &&alu_in,
+            [ALU_SWAP_IN] = &&alu_swap_in,
+            [ALU_T_N] = &&alu_t_n,
+            [ALU_ADD] = &&alu_add,
+            [ALU_AND] = &&alu_and,
+            [ALU_OR] = &&alu_or,
+            [ALU_XOR] = &&alu_xor,
+            [ALU_MUL] = &&alu_mul,
+            [ALU_INVERT] = &&alu_invert,
+            [ALU_EQ] = &&alu_eq,
+            [ALU_GT] = &&alu_gt,
+            [ALU_U_GT] = &&alu_u_gt,
+            [ALU_RSHIFT] = &&alu_rshift,
+            [ALU_LSHIFT] = &&alu_lshift,
+            [ALU_LOAD] = &&alu_load,
+            [ALU_IO_READ] = &&alu_io_read };
+    static void* const out_mux[4] = {
+            [OUTPUT_T] = &&out_t,
+            [OUTPUT_R] = &&out_r,
+            [OUTPUT_IO_T] = &&out_io_t,
+            [OUTPUT_MEM_T] = &&out_mem_t };
+
+    DISPATCH();
+
+    decode:
+        predecode_at(ctx, rec, (uint16_t)EIP);
+        goto *rec->handler;
+
+    // == Literals
+    op_lit:
+        STEP();
+        ctx->DSTACK[SP-1] = T;
+        SP++;
+        T = rec->lit;
+        DISPATCH();
+    op_lit_add:
+        STEP();
+        T += rec->lit;
+        DISPATCH();
+
+    // == Jumps and calls
+    op_jmp:
+        STEP();
+        EIP = rec->target;
+        BUDGET_CHECK();
+        DISPATCH();
+    op_cjmp: {
+        STEP();
+        SP--;
+        bool RES = (uint64_t)T;
+        T = ctx->DSTACK[SP-1];
+        if (!RES) {
+            EIP = rec->target;
+            BUDGET_CHECK();
+        }
+        DISPATCH();
+    }
+    op_call:
+        STEP();
+        ctx->RSTACK[RSP-1] = R;
+        R = EIP;
+        ctx->RSTACK[RSP] = EIP;
+        RSP++;
+        EIP = rec->target;
+        BUDGET_CHECK();
+        DISPATCH();
+
+    // == Superinstructions: each retires two instructions.  The literal
+    // is IN and T is N, as when the pair runs unfused.
+    lit_add_n:
+        STEP_PAIR(rec->lit);
+        T = rec->lit + T;
+        DISPATCH();
+    lit_and_n:
+        STEP_PAIR(rec->lit);
+        T = rec->lit & T;
+        DISPATCH();
+    lit_or_n:
+        STEP_PAIR(rec->lit);
+        T = rec->lit | T;
+        DISPATCH();
+    lit_xor_n:
+        STEP_PAIR(rec->lit);
+        T = rec->lit ^ T;
+        DISPATCH();
+    lit_mul_n:
+        STEP_PAIR(rec->lit);
+        T = rec->lit * T;
+        DISPATCH();
+    lit_eq_n:
+        STEP_PAIR(rec->lit);
+        T = rec->lit == T ? TRUE : FALSE;
+        DISPATCH();
+    lit_gt_n:
+        STEP_PAIR(rec->lit);
+        T = T < rec->lit ? TRUE : FALSE;
+        DISPATCH();
+    lit_u_gt_n:
+        STEP_PAIR(rec->lit);
+        T = (uint64_t) T < (uint64_t) rec->lit ? TRUE : FALSE;
+        DISPATCH();
+    dup_cjmp:
+        STEP_PAIR(T);
+        if (!T) {
+            EIP = rec->target;
+            BUDGET_CHECK();
+        }
+        DISPATCH();
+
+    // == ALU: returns check the budget before they run, so a preempted
+    // run resumes at the return itself; a run starting on one takes it.
+    ret_n:
+        RET_BUDGET_CHECK();
+        goto in_n;
+    ret_t:
+        RET_BUDGET_CHECK();
+        goto in_t;
+    ret_load_t:
+        RET_BUDGET_CHECK();
+        goto in_load_t;
+    ret_r:
+        RET_BUDGET_CHECK();
+        goto in_r;
+
+    // == ALU: input select
+    in_n:
+        STEP();
+        N = ctx->DSTACK[SP-2];
+        IN = N;
+        goto *alu_op[rec->alu.alu_op];
+    in_t:
+        STEP();
+        N = ctx->DSTACK[SP-2];
+        IN = T;
+        goto *alu_op[rec->alu.alu_op];
+    in_load_t:
+        STEP();
+        N = ctx->DSTACK[SP-2];
+        IN = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+T);
+        goto *alu_op[rec->alu.alu_op];
+    in_r:
+        STEP();
+        N = ctx->DSTACK[SP-2];
+        IN = R;
+        goto *alu_op[rec->alu.alu_op];
+
+    // == ALU: operation
+    alu_in:
+        OUT = IN;
+        goto alu_stacks;
+    alu_swap_in:
+        OUT = ctx->DSTACK[SP - 2];
+        ctx->DSTACK[SP - 2] = T;
+        T = OUT;
+        OUT = IN;
+        goto alu_stacks;
+    alu_t_n:
+        ctx->DSTACK[SP - 2] = T;
+        OUT = IN;
+        goto alu_stacks;
+    alu_add:
+        OUT = IN + N;
+        goto alu_stacks;
+    alu_and:
+        OUT = IN & N;
+        goto alu_stacks;
+    alu_or:
+        OUT = IN | N;
+        goto alu_stacks;
+    alu_xor:
+        OUT = IN ^ N;
+        goto alu_stacks;
+    alu_mul:
+        OUT = IN * N;
+        goto alu_stacks;
+    alu_invert:
+        OUT = ~IN;
+        goto alu_stacks;
+    alu_eq:
+        OUT = IN == N ? TRUE : FALSE;
+        goto alu_stacks;
+    alu_gt:
+        OUT = N < IN ? TRUE : FALSE;
+        goto alu_stacks;
+    alu_u_gt:
+        OUT = (uint64_t) N < (uint64_t) IN ? TRUE : FALSE;
+        goto alu_stacks;
+    alu_rshift:
+        OUT = (uint64_t) IN >> T;
+        goto alu_stacks;
+    alu_lshift:
+        OUT = (uint64_t) IN << T;
+        goto alu_stacks;
+    alu_load:
+        OUT = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+IN);
+        goto alu_stacks;
+    alu_io_read:
+        OUT = io_read_handler(ctx, IN);
+        goto alu_stacks;
+
+    // == ALU: R->EIP, stack adjustment, then output select
+    alu_stacks:
+        if (rec->alu.r_eip) EIP = R;
+        SP += rec->alu.dstack;
+        RSP += rec->alu.rstack;
+        if (rec->alu.dstack > 0) {
+            ctx->DSTACK[SP - 2] = T;
+        }
+        if (rec->alu.rstack > 0) {
+            ctx->RSTACK[RSP - 2] = R;
+        }
+        goto *out_mux[rec->alu.out_mux];
+    out_t:
+        T = OUT;
+        if (rec->alu.rstack < 0) {
+            R = ctx->RSTACK[RSP - 1];
+        }
+        DISPATCH();
+    out_r:
+        R = OUT;
+        if (rec->alu.dstack < 0) {
+            T = ctx->DSTACK[SP - 1];
+        }
+        DISPATCH();
+    out_io_t:
+        ctx->SP = SP;
+        ctx->RSP = RSP;
+        ctx->EIP = EIP;
+        io_write_handler(ctx, T, OUT);
+        if (rec->alu.dstack < 0) {
+            T = ctx->DSTACK[SP - 1];
+        }
+        if (rec->alu.rstack < 0) {
+            R = ctx->RSTACK[RSP - 1];
+        }
+        DISPATCH();
+    out_mem_t:
+        *(int64_t*)((uint8_t*)(&ctx->memory[0])+T) = OUT;
+        STORE_INVALIDATE(T);
+        if (rec->alu.dstack < 0) {
+            T = ctx->DSTACK[SP - 1];
+        }
+        if (rec->alu.rstack < 0) {
+            R = ctx->RSTACK[RSP - 1];
+        }
+        DISPATCH();
+
+    // == `T->IN [IN]` with a width, see `INS_NARROW()`.
+    narrow_load:
+        STEP();
+        SP += rec->alu.dstack;
+        if (rec->alu.dstack > 0) {
+            ctx->DSTACK[SP - 2] = T;
+        }
+        T = vm_load_narrow(ctx, T, (BYTE)rec->alu.rstack & 3);
+        DISPATCH();
+    narrow_store:
+        STEP();
+        vm_store_narrow(ctx, T, ctx->DSTACK[SP - 2],
+                        (BYTE)rec->alu.rstack & 3);
+        STORE_INVALIDATE(T);
+        SP += rec->alu.dstack;
+        if (rec->alu.dstack > 0) {
+            ctx->DSTACK[SP - 2] = T;
+        }
+        if (rec->alu.dstack < 0) {
+            T = ctx->DSTACK[SP - 1];
+        }
+        DISPATCH();
+
+    // == `T->IN IN<<T`, see `INS_EXT()`.
+    ext:
+        STEP();
+        ctx->DSTACK[SP - 1] = T;
+        SP = vm_ext(ctx, rec->alu.alu_op, SP);
+        T = ctx->DSTACK[SP - 1];
+        DISPATCH();
+
+    preempted:
+        status = VM_PREEMPTED;
+    halt:
+#ifdef DEBUG
+    print_state(ctx, RSP, SP, EIP, R, T);
+#endif
+    ctx->CYCLES = cycles;
+    ctx->DSTACK[SP-1] = T;
+    ctx->RSTACK[RSP-1] = R;
+    ctx->SP = SP;
+    ctx->RSP = RSP;
+    ctx->EIP = EIP;
+    vm_out_flush(ctx);
+    return status;
+}
+
+#else
+
+// Without labels-as-values there is nothing to pre-decode into; run the
+// switch engine.
+void vm_predecode(context *ctx) {
+}
+
+void vm_predecode_invalidate(context *ctx, uint32_t addr, uint32_t count) {
+}
+
+int vm_predecoded(context *ctx) {
+    return vm_switch(ctx);
+}
+
+#endif // __GNUC__
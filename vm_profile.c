@@ -0,0 +1,151 @@
+//
+// vm_profile.c - instruction bigram and trigram counts.
+//
+// Built with VM_PROFILE, the switch engine hands every instruction it
+// executes to `vm_profile_record()`, which counts the sequences of two and
+// three instructions in execution order.  Literals and jumps are counted by
+// kind, without their value or target, so `lit +` is one bigram no matter
+// which literal it adds.  `vm_profile_report()` prints the most frequent
+// sequences: the candidates for superinstructions in the fused engine.
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "vm_instruction.h"
+#include "vm_opcodes.h"
+
+#define PROFILE_SLOTS 65536
+#define PROFILE_PROBES 64
+
+typedef struct {
+    uint64_t   key;
+    uint64_t   count;
+} ngram;
+
+struct vm_profile {
+    uint64_t   total;           // instructions recorded
+    uint64_t   dropped;         // n-grams that found no free slot
+    uint16_t   history[2];      // the last two instructions, newest first
+    uint8_t    depth;           // how many of `history` are valid
+    ngram      bigrams[PROFILE_SLOTS];
+    ngram      trigrams[PROFILE_SLOTS];
+};
+
+// Literals keep only `lit_f` and `lit_add`, jumps only their type.
+static uint16_t profile_op(uint16_t raw) {
+    instruction ins = *(instruction*)&raw;
+    if (ins.lit.lit_f) {
+        return raw & 0xc000;
+    }
+    if (ins.alu.op_type != OP_TYPE_ALU) {
+        return raw & 0xe000;
+    }
+    return raw;
+}
+
+static void profile_count(struct vm_profile *profile, ngram *table,
+                          uint64_t key) {
+    uint32_t slot = (key * 0x9e3779b97f4a7c15ULL) >> 48;
+    for (int probe = 0; probe < PROFILE_PROBES; probe++) {
+        ngram *entry = &table[(slot + probe) % PROFILE_SLOTS];
+        if (!entry->count || entry->key == key) {
+            entry->key = key;
+            entry->count++;
+            return;
+        }
+    }
+    profile->dropped++;
+}
+
+void vm_profile_record(context *ctx, uint16_t raw) {
+    struct vm_profile *profile = ctx->profile;
+    if (!profile) {
+        profile = ctx->profile = calloc(1, sizeof(struct vm_profile));
+        if (!profile) return;
+    }
+    uint16_t op = profile_op(raw);
+    profile->total++;
+    if (profile->depth >= 1) {
+        profile_count(profile, profile->bigrams,
+                      (uint64_t)profile->history[0] << 16 | op);
+    }
+    if (profile->depth >= 2) {
+        profile_count(profile, profile->trigrams,
+                      (uint64_t)profile->history[1] << 32 |
+                      (uint64_t)profile->history[0] << 16 | op);
+    }
+    profile->history[1] = profile->history[0];
+    profile->history[0] = op;
+    if (profile->depth < 2) profile->depth++;
+}
+
+static void profile_op_name(context *ctx, uint16_t op, char *out) {
+    instruction ins = *(instruction*)&op;
+    const char *name = NULL;
+    if (ins.lit.lit_f) {
+        name = ins.lit.lit_add ? "lit+" : "lit";
+    } else if (ins.alu.op_type == OP_TYPE_JMP) {
+        name = "jmp";
+    } else if (ins.alu.op_type == OP_TYPE_CJMP) {
+        name = "0branch";
+    } else if (ins.alu.op_type == OP_TYPE_CALL) {
+        name = "call";
+    } else if (ctx->words) {
+        name = lookup_opcode(ctx->words, ins);
+    }
+    if (name) {
+        sprintf(out, "%s", name);
+    } else {
+        sprintf(out, "alu:%04x", op);
+    }
+}
+
+static int ngram_by_count(const void *a, const void *b) {
+    uint64_t ca = ((const ngram*)a)->count;
+    uint64_t cb = ((const ngram*)b)->count;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+static void profile_report_table(context *ctx, FILE *out, const ngram *table,
+                                 int n, size_t top) {
+    ngram *sorted = malloc(sizeof(ngram) * PROFILE_SLOTS);
+    size_t used = 0;
+    for (int slot = 0; slot < PROFILE_SLOTS; slot++) {
+        if (table[slot].count) sorted[used++] = table[slot];
+    }
+    qsort(sorted, used, sizeof(ngram), ngram_by_count);
+    fprintf(out, "%d-grams: %zu distinct\n", n, used);
+    for (size_t idx = 0; idx < used && idx < top; idx++) {
+        char line[96] = "";
+        for (int pos = n - 1; pos >= 0; pos--) {
+            char name[32];
+            profile_op_name(ctx, (uint16_t)(sorted[idx].key >> (pos * 16)),
+                            name);
+            sprintf(line + strlen(line), "%s%s", name, pos ? " " : "");
+        }
+        fprintf(out, "  %14llu %6.2f%%  %s\n",
+                (unsigned long long)sorted[idx].count,
+                100.0 * sorted[idx].count / ctx->profile->total, line);
+    }
+    free(sorted);
+}
+
+void vm_profile_report(context *ctx, FILE *out, size_t top) {
+    struct vm_profile *profile = ctx->profile;
+    if (!profile) {
+        fprintf(out, "No instructions profiled.\n");
+        return;
+    }
+    fprintf(out, "%llu instructions profiled",
+            (unsigned long long)profile->total);
+    if (profile->dropped) {
+        fprintf(out, ", %llu n-grams dropped from full tables",
+                (unsigned long long)profile->dropped);
+    }
+    fprintf(out, "\n");
+    profile_report_table(ctx, out, profile->bigrams, 2, top);
+    profile_report_table(ctx, out, profile->trigrams, 3, top);
+}
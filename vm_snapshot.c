@@ -0,0 +1,154 @@
+//
+// vm_snapshot.c - copy-on-write snapshots and clones of a context.
+//
+// `vm_snapshot()` copies a whole context, memory and stacks included,
+// into an anonymous file.  `vm_clone()` maps that file privately, so a
+// clone is ready as soon as the mapping exists and only the pages it
+// writes to are copied.  Memory is written sparsely, skipping pages that
+// are all zero, so a large, mostly untouched memory costs little to
+// snapshot.  The stacks live in their own guarded mappings, so a clone
+// gets new ones with the snapshot's contents read into them.
+// Side tables an engine attached to the original (`decoded`, `jit`,
+// `dict`, `profile`, `ring`) are not carried over; a clone builds its own
+// when it first runs.  Nor are the devices a host attached with
+// `vm_io_attach()`: a clone starts with the console, and the host attaches
+// its own.  `meta` names are shared, and must outlive every clone.
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "vm.h"
+
+struct vm_snapshot {
+    int        fd;
+    size_t     size;            // bytes of context; memory and the stacks
+                                // follow
+};
+
+static size_t snapshot_size(void) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (sizeof(context) + page - 1) / page * page;
+}
+
+static int snapshot_fd(void) {
+#if defined(__linux__)
+    return memfd_create("hexaforth-snapshot", MFD_CLOEXEC);
+#else
+    FILE *file = tmpfile();
+    return file ? dup(fileno(file)) : -1;
+#endif
+}
+
+// Write the pages of `memory` that aren't all zero to `fd` at `offset`;
+// the file reads as zero everywhere else.
+static bool snapshot_memory(int fd, const uint16_t *memory, uint64_t bytes,
+                            off_t offset) {
+    static const uint8_t zero[4096];
+    const uint8_t *data = (const uint8_t*)memory;
+    for (uint64_t at = 0; at < bytes; at += sizeof(zero)) {
+        size_t chunk = bytes - at < sizeof(zero) ? bytes - at : sizeof(zero);
+        if (memcmp(data + at, zero, chunk) != 0 &&
+            pwrite(fd, data + at, chunk, offset + at) != (ssize_t)chunk) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bytes of parking cells and cells of a stack `depth` deep.
+static size_t stack_bytes(uint32_t depth) {
+    return depth ? (depth + VM_STACK_PARK) * sizeof(int64_t) : 0;
+}
+
+// Freeze the current state of `ctx`.  Returns NULL if there's no room
+// for the copy.
+struct vm_snapshot* vm_snapshot(context *ctx) {
+    struct vm_snapshot *snap = calloc(1, sizeof(struct vm_snapshot));
+    if (!snap) return NULL;
+    snap->size = snapshot_size();
+    snap->fd = snapshot_fd();
+    off_t stacks = snap->size + ctx->MEMORY_BYTES;
+    size_t dstack = stack_bytes(ctx->DSTACK_DEPTH);
+    size_t rstack = stack_bytes(ctx->RSTACK_DEPTH);
+    context *copy = MAP_FAILED;
+    if (snap->fd >= 0 &&
+        ftruncate(snap->fd, stacks + dstack + rstack) == 0 &&
+        snapshot_memory(snap->fd, ctx->memory, ctx->MEMORY_BYTES,
+                        snap->size) &&
+        pwrite(snap->fd, ctx->DSTACK - VM_STACK_PARK, dstack,
+               stacks) == (ssize_t)dstack &&
+        pwrite(snap->fd, ctx->RSTACK - VM_STACK_PARK, rstack,
+               stacks + dstack) == (ssize_t)rstack) {
+        copy = mmap(NULL, snap->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    snap->fd, 0);
+    }
+    if (copy == MAP_FAILED) {
+        vm_snapshot_release(snap);
+        return NULL;
+    }
+    memcpy(copy, ctx, sizeof(context));
+    copy->memory = NULL;
+    copy->DSTACK = NULL;
+    copy->RSTACK = NULL;
+    copy->decoded = NULL;
+    copy->jit = NULL;
+    copy->dict = NULL;
+    copy->io = NULL;
+    copy->OUT_LEN = 0;
+    copy->profile = NULL;
+    copy->ring = NULL;
+    munmap(copy, snap->size);
+    return snap;
+}
+
+// A new context in the state `snap` was taken in, sharing its pages until
+// either writes to them.  Release it with `vm_clone_release()`.
+context* vm_clone(struct vm_snapshot *snap) {
+    context *ctx = mmap(NULL, snap->size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, snap->fd, 0);
+    if (ctx == MAP_FAILED) {
+        return NULL;
+    }
+    uint16_t *memory = mmap(NULL, ctx->MEMORY_BYTES, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_NORESERVE, snap->fd,
+                            snap->size);
+    ctx->memory = memory == MAP_FAILED ? NULL : memory;
+    if (!ctx->memory) {
+        vm_clone_release(ctx);
+        return NULL;
+    }
+    if (!ctx->DSTACK_DEPTH) {
+        return ctx;
+    }
+    int SP = ctx->SP;
+    int RSP = ctx->RSP;
+    off_t stacks = snap->size + ctx->MEMORY_BYTES;
+    size_t dstack = stack_bytes(ctx->DSTACK_DEPTH);
+    size_t rstack = stack_bytes(ctx->RSTACK_DEPTH);
+    if (!vm_stacks(ctx, ctx->DSTACK_DEPTH, ctx->RSTACK_DEPTH) ||
+        pread(snap->fd, ctx->DSTACK - VM_STACK_PARK, dstack,
+              stacks) != (ssize_t)dstack ||
+        pread(snap->fd, ctx->RSTACK - VM_STACK_PARK, rstack,
+              stacks + dstack) != (ssize_t)rstack) {
+        vm_clone_release(ctx);
+        return NULL;
+    }
+    ctx->SP = SP;
+    ctx->RSP = RSP;
+    return ctx;
+}
+
+void vm_clone_release(context *ctx) {
+    vm_release(ctx);
+    munmap(ctx, snapshot_size());
+}
+
+// Clones already made keep working after their snapshot is released.
+void vm_snapshot_release(struct vm_snapshot *snap) {
+    if (snap->fd >= 0) close(snap->fd);
+    free(snap);
+}
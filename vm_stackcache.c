@@ -0,0 +1,98 @@
+//
+// vm_stackcache.c - threaded engine that caches up to three stack items.
+//
+// The other engines keep only T in a register.  Every ALU instruction
+// reloads N from `ctx->DSTACK`, and every push or pop goes through memory.
+// This engine can also hold N and the third item in registers.  It has a
+// separate copy of every handler for each cache state (see
+// vm_stackcache_state.h), so each handler spills or fills only what its
+// state needs and then jumps into the copy for the state it leaves.
+//
+// Cached items are written back before io writes and on halt, so io
+// handlers and callers see the same `ctx->DSTACK` as with the other
+// engines.  Build with VM_STATS to count stack loads and stores.
+//
+
+#include <stdbool.h>
+#include "vm.h"
+#include "vm_instruction.h"
+#include "vm_constants.h"
+#ifdef DEBUG
+#include "vm_debug.h"
+#include "vm_opcodes.h"
+#endif // DEBUG
+
+#if defined(__GNUC__)
+
+#ifdef DEBUG
+#define TRACE() print_state(ctx, RSP, SP, EIP, R, T)
+#else
+#define TRACE()
+#endif // DEBUG
+
+#define CAT_(a, b) a##_##b
+#define CAT(a, b) CAT_(a, b)
+#define L(name) CAT(name, S)
+
+// ALU ops that read N: SWAP_IN, ADD, AND, OR, XOR, MUL, EQ, GT and U_GT.
+#define ALU_READS_N 0x0efa
+
+// Write the `K` cached items back to their slots; they stay cached.
+#define SPILL(K) do {                               \
+        if ((K) >= 1) DSTORE(SP-2, N1);             \
+        if ((K) == 2) DSTORE(SP-3, N2);             \
+    } while (0)
+
+int vm_stackcache(context *ctx) {
+    register int16_t EIP = ctx->EIP;        // EIP = execution pointer
+    register int16_t SP = ctx->SP;          // SP = data stack pointer
+    register int16_t RSP = ctx->RSP;        // RSP = return stack pointer
+    register int64_t T = DLOAD(SP-1);       // T = Top Of Stack / TOS
+    register int64_t N1 = 0;                // N1 = N, when cached
+    register int64_t N2 = 0;                // N2 = third item, when cached
+    register int64_t R = ctx->RSTACK[RSP-1]; // R = Top Of Return Stack / TOR
+    register int64_t IN = 0;                // I = input to ALU
+    register int64_t OUT = 0;               // OUT - result from ALU
+    register uint64_t cycles = ctx->CYCLES; // how many instructions processed
+    uint64_t limit = ctx->CYCLE_LIMIT;      // stop at a branch past this
+    uint64_t start = cycles;                // the first always runs
+    int status = VM_HALTED;
+    uint16_t raw;
+    instruction ins;
+
+    goto dispatch_0;
+
+#define S 0
+#include "vm_stackcache_state.h"
+#undef S
+#define S 1
+#include "vm_stackcache_state.h"
+#undef S
+#define S 2
+#include "vm_stackcache_state.h"
+#undef S
+
+    preempted:
+    status = VM_PREEMPTED;
+    halt:
+#ifdef DEBUG
+    print_state(ctx, RSP, SP, EIP, R, T);
+#endif
+    ctx->CYCLES = cycles;
+    DSTORE(SP-1, T);
+    ctx->RSTACK[RSP-1] = R;
+    ctx->SP = SP;
+    ctx->RSP = RSP;
+    ctx->EIP = EIP;
+    vm_out_flush(ctx);
+    return status;
+}
+
+#else
+
+// Labels-as-values is a GNU extension; without it, run the switch engine.
+int vm_stackcache(context *ctx) {
+    return vm_switch(ctx);
+}
+
+#endif // __GNUC__
@@ -0,0 +1,387 @@
+//
+// vm_stackcache_state.h - handlers for one stack cache state.
+//
+// Included by vm_stackcache.c inside `vm_stackcache()` once per state, with
+// `S` defined as the number of items below T held in registers: 0 (none),
+// 1 (N in `N1`) or 2 (N in `N1`, the third item in `N2`).  Labels get `_S`
+// appended by `L()`, and every `if (S ...)` folds away.
+//
+// Only cached items can be out of date in `ctx->DSTACK`; everything below
+// them is always in memory.
+//
+
+// States reached by growing or shrinking the stack by one item.
+#if S == 0
+#define S_UP 1
+#define S_DOWN 0
+#elif S == 1
+#define S_UP 2
+#define S_DOWN 0
+#else
+#define S_UP 2
+#define S_DOWN 1
+#endif
+
+// N, from the cache or from memory.
+#define N_VALUE (S >= 1 ? N1 : DLOAD(SP-2))
+
+// Push `X`, spilling the deepest cached item if the cache is full.
+#define PUSH(X) do {                                \
+        int64_t pushed = (X);                       \
+        if (S == 2) DSTORE(SP-3, N2);               \
+        if (S >= 1) N2 = N1;                        \
+        N1 = T;                                     \
+        T = pushed;                                 \
+        SP++;                                       \
+    } while (0)
+
+// Pop T, making N the new T.
+#define POP() do {                                  \
+        SP--;                                       \
+        if (S >= 1) T = N1; else T = DLOAD(SP-1);   \
+        if (S == 2) N1 = N2;                        \
+    } while (0)
+
+// Drop N, keeping T.
+#define NIP() do {                                  \
+        SP--;                                       \
+        if (S == 2) N1 = N2;                        \
+    } while (0)
+
+// Pop T and N, making the third item the new T.
+#define POP2() do {                                 \
+        SP -= 2;                                    \
+        if (S == 2) T = N2; else T = DLOAD(SP-1);   \
+    } while (0)
+
+#define R_RESOLVE() do {                            \
+        if (ins.alu.rstack < 0) {                   \
+            R = ctx->RSTACK[RSP - 1];               \
+        }                                           \
+    } while (0)
+
+#define IO_WRITE(ADDR) do {                         \
+        ctx->SP = SP;                               \
+        ctx->RSP = RSP;                             \
+        ctx->EIP = EIP;                             \
+        io_write_handler(ctx, (ADDR), OUT);         \
+    } while (0)
+
+    static void* const L(op_class)[8] = {
+            &&L(op_jmp), &&L(op_cjmp), &&L(op_call), &&L(op_alu),
+            &&L(op_lit), &&L(op_lit), &&L(op_lit_add), &&L(op_lit_add) };
+    static void* const L(in_mux)[4] = {
+            [INPUT_N] = &&L(in_n),
+            [INPUT_T] = &&L(in_t),
+            [INPUT_LOAD_T] = &&L(in_load_t),
+            [INPUT_R] = &&L(in_r) };
+    static void* const L(alu_op)[16] = {
+            [ALU_IN] = &&L(alu_in),
+            [ALU_SWAP_IN] = &&L(alu_swap_in),
+            [ALU_T_N] = &&L(alu_t_n),
+            [ALU_ADD] = &&L(alu_add),
+            [ALU_AND] = &&L(alu_and),
+            [ALU_OR] = &&L(alu_or),
+            [ALU_XOR] = &&L(alu_xor),
+            [ALU_MUL] = &&L(alu_mul),
+            [ALU_INVERT] = &&L(alu_invert),
+            [ALU_EQ] = &&L(alu_eq),
+            [ALU_GT] = &&L(alu_gt),
+            [ALU_U_GT] = &&L(alu_u_gt),
+            [ALU_RSHIFT] = &&L(alu_rshift),
+            [ALU_LSHIFT] = &&L(alu_lshift),
+            [ALU_LOAD] = &&L(alu_load),
+            [ALU_IO_READ] = &&L(alu_io_read) };
+    // Indexed by `(dstack & 3) << 2 | out_mux`.
+    static void* const L(tail)[16] = {
+            &&L(d0_t), &&L(d0_r), &&L(d0_io), &&L(d0_mem),
+            &&L(up_t), &&L(up_r), &&L(up_io), &&L(up_mem),
+            &&L(down2_t), &&L(down2_r), &&L(down2_io), &&L(down2_mem),
+            &&L(down_t), &&L(down_r), &&L(down_io), &&L(down_mem) };
+
+    L(dispatch):
+        raw = ctx->memory[(uint16_t)EIP];
+#ifdef DEBUG
+        if (S >= 1) ctx->DSTACK[SP-2] = N1;
+        if (S == 2) ctx->DSTACK[SP-3] = N2;
+#endif // DEBUG
+        if (!raw) goto L(halt);
+        ins = *(instruction*)&(ctx->memory[EIP]);
+        TRACE();
+        EIP++;
+        cycles++;
+        goto *L(op_class)[raw >> 13];
+
+    // == Literals
+    L(op_lit):
+        PUSH((int64_t)((uint64_t)ins.lit.lit_v <<
+                       (ins.lit.lit_shifts * LIT_BITS)));
+        goto CAT(dispatch, S_UP);
+    L(op_lit_add):
+        T += (int64_t)((uint64_t)ins.lit.lit_v <<
+                       (ins.lit.lit_shifts * LIT_BITS));
+        goto L(dispatch);
+
+    // == Jumps and calls
+    L(op_jmp):
+        EIP = ins.jmp.target;
+        if (cycles >= limit) goto L(preempt);
+        goto L(dispatch);
+    L(op_cjmp): {
+        bool RES = (uint64_t)T;
+        POP();
+        if (!RES) {
+            EIP = ins.jmp.target;
+            if (cycles >= limit) goto CAT(preempt, S_DOWN);
+        }
+        goto CAT(dispatch, S_DOWN);
+    }
+    L(op_call):
+        ctx->RSTACK[RSP-1] = R;
+        R = EIP;
+        ctx->RSTACK[RSP] = EIP;
+        RSP++;
+        EIP = ins.jmp.target;
+        if (cycles >= limit) goto L(preempt);
+        goto L(dispatch);
+
+    // == ALU: a return over budget is put back unexecuted, so a preempted
+    // run resumes at the return itself, unless it is the first instruction
+    // of the run.  With nothing cached, fill N only if the instruction
+    // reads it.
+    L(op_alu):
+        if (ins.alu.r_eip && cycles >= limit && cycles > start + 1) {
+            EIP--;
+            cycles--;
+            goto L(preempt);
+        }
+        if (S == 0 && (ins.alu.in_mux == INPUT_N ||
+                       (ALU_READS_N >> ins.alu.alu_op) & 1)) {
+            N1 = DLOAD(SP-2);
+            goto alu_body_1;
+        }
+    L(alu_body):
+        goto *L(in_mux)[ins.alu.in_mux];
+    L(in_n):
+        IN = N_VALUE;
+        goto *L(alu_op)[ins.alu.alu_op];
+    L(in_t):
+        IN = T;
+        goto *L(alu_op)[ins.alu.alu_op];
+    L(in_load_t):
+        IN = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+T);
+        goto *L(alu_op)[ins.alu.alu_op];
+    L(in_r):
+        IN = R;
+        goto *L(alu_op)[ins.alu.alu_op];
+
+    L(alu_in):
+        OUT = IN;
+        goto L(alu_stacks);
+    L(alu_swap_in):
+        if (S >= 1) {
+            OUT = N1;
+            N1 = T;
+        } else {
+            OUT = DLOAD(SP - 2);
+            DSTORE(SP - 2, T);
+        }
+        T = OUT;
+        OUT = IN;
+        goto L(alu_stacks);
+    L(alu_t_n):
+        if (S >= 1) N1 = T; else DSTORE(SP - 2, T);
+        OUT = IN;
+        goto L(alu_stacks);
+    L(alu_add):
+        OUT = IN + N_VALUE;
+        goto L(alu_stacks);
+    L(alu_and):
+        OUT = IN & N_VALUE;
+        goto L(alu_stacks);
+    L(alu_or):
+        OUT = IN | N_VALUE;
+        goto L(alu_stacks);
+    L(alu_xor):
+        OUT = IN ^ N_VALUE;
+        goto L(alu_stacks);
+    L(alu_mul):
+        OUT = IN * N_VALUE;
+        goto L(alu_stacks);
+    L(alu_invert):
+        OUT = ~IN;
+        goto L(alu_stacks);
+    L(alu_eq):
+        OUT = IN == N_VALUE ? TRUE : FALSE;
+        goto L(alu_stacks);
+    L(alu_gt):
+        OUT = N_VALUE < IN ? TRUE : FALSE;
+        goto L(alu_stacks);
+    L(alu_u_gt):
+        OUT = (uint64_t) N_VALUE < (uint64_t) IN ? TRUE : FALSE;
+        goto L(alu_stacks);
+    L(alu_rshift):
+        OUT = (uint64_t) IN >> T;
+        goto L(alu_stacks);
+    L(alu_lshift):
+        if (INS_EXT(ins)) goto L(ext);
+        OUT = (uint64_t) IN << T;
+        goto L(alu_stacks);
+    L(alu_load):
+        if (INS_NARROW(ins)) goto L(narrow);
+        OUT = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+IN);
+        goto L(alu_stacks);
+    L(alu_io_read):
+        OUT = io_read_handler(ctx, IN);
+        goto L(alu_stacks);
+
+    L(alu_stacks):
+        if (ins.alu.r_eip) EIP = R;
+        RSP += ins.alu.rstack;
+        if (ins.alu.rstack > 0) {
+            ctx->RSTACK[RSP - 2] = R;
+        }
+        goto *L(tail)[(ins.alu.dstack & 3) << 2 | ins.alu.out_mux];
+
+    // == ALU: d+0
+    L(d0_t):
+        T = OUT;
+        R_RESOLVE();
+        goto L(dispatch);
+    L(d0_r):
+        R = OUT;
+        goto L(dispatch);
+    L(d0_io):
+        SPILL(S);
+        IO_WRITE(T);
+        R_RESOLVE();
+        goto L(dispatch);
+    L(d0_mem):
+        *(int64_t*)((uint8_t*)(&ctx->memory[0])+T) = OUT;
+        R_RESOLVE();
+        goto L(dispatch);
+
+    // == ALU: d+1, T is kept under the result.
+    L(up_t):
+        PUSH(OUT);
+        R_RESOLVE();
+        goto CAT(dispatch, S_UP);
+    L(up_r):
+        PUSH(T);
+        R = OUT;
+        goto CAT(dispatch, S_UP);
+    L(up_io):
+        PUSH(T);
+        SPILL(S_UP);
+        IO_WRITE(T);
+        R_RESOLVE();
+        goto CAT(dispatch, S_UP);
+    L(up_mem):
+        PUSH(T);
+        *(int64_t*)((uint8_t*)(&ctx->memory[0])+T) = OUT;
+        R_RESOLVE();
+        goto CAT(dispatch, S_UP);
+
+    // == ALU: d-1, the result replaces N or N becomes T.
+    L(down_t):
+        T = OUT;
+        NIP();
+        R_RESOLVE();
+        goto CAT(dispatch, S_DOWN);
+    L(down_r):
+        R = OUT;
+        POP();
+        goto CAT(dispatch, S_DOWN);
+    // The io handler may look at the stack, so the new top is reloaded
+    // from memory after it returns, as in vm_switch().
+    L(down_io):
+        SP--;
+        if (S >= 1) DSTORE(SP-1, N1);
+        if (S == 2) DSTORE(SP-2, N2);
+        IO_WRITE(T);
+        T = DLOAD(SP-1);
+        R_RESOLVE();
+        goto dispatch_0;
+    L(down_mem):
+        *(int64_t*)((uint8_t*)(&ctx->memory[0])+T) = OUT;
+        POP();
+        R_RESOLVE();
+        goto CAT(dispatch, S_DOWN);
+
+    // == ALU: d-2, everything cached is consumed.
+    L(down2_t):
+        T = OUT;
+        SP -= 2;
+        R_RESOLVE();
+        goto dispatch_0;
+    L(down2_r):
+        R = OUT;
+        POP2();
+        goto dispatch_0;
+    L(down2_io):
+        SP -= 2;
+        if (S == 2) DSTORE(SP-1, N2);
+        IO_WRITE(T);
+        T = DLOAD(SP-1);
+        R_RESOLVE();
+        goto dispatch_0;
+    L(down2_mem):
+        *(int64_t*)((uint8_t*)(&ctx->memory[0])+T) = OUT;
+        POP2();
+        R_RESOLVE();
+        goto dispatch_0;
+
+    // == `T->IN [IN]` with a width, see `INS_NARROW()`.  The rstack bits
+    // are the width here, so the tails above can't be used; `c@` and `c!`
+    // get their own paths and the rest go through memory.
+    L(narrow): {
+        BYTE width = INS_WIDTH(ins);
+        if (ins.alu.out_mux != OUTPUT_MEM_T) {
+            if (ins.alu.dstack == 0) {
+                T = vm_load_narrow(ctx, T, width);
+                goto L(dispatch);
+            }
+        } else {
+            vm_store_narrow(ctx, T, N_VALUE, width);
+            if (ins.alu.dstack == -2) {
+                POP2();
+                goto dispatch_0;
+            }
+        }
+        SPILL(S);
+        SP += ins.alu.dstack;
+        if (ins.alu.dstack > 0) {
+            DSTORE(SP - 2, T);
+        }
+        if (ins.alu.out_mux != OUTPUT_MEM_T) {
+            T = vm_load_narrow(ctx, T, width);
+        } else if (ins.alu.dstack < 0) {
+            T = DLOAD(SP - 1);
+        }
+        goto dispatch_0;
+    }
+
+    // == `T->IN IN<<T`, see `INS_EXT()`: run from memory.
+    L(ext):
+        SPILL(S);
+        DSTORE(SP - 1, T);
+        SP = vm_ext(ctx, INS_EXT_OP(ins), SP);
+        T = DLOAD(SP - 1);
+        goto dispatch_0;
+
+    L(halt):
+        SPILL(S);
+        goto halt;
+    L(preempt):
+        SPILL(S);
+        goto preempted;
+
+#undef S_UP
+#undef S_DOWN
+#undef N_VALUE
+#undef PUSH
+#undef POP
+#undef NIP
+#undef POP2
+#undef R_RESOLVE
+#undef IO_WRITE
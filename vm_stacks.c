@@ -0,0 +1,167 @@
+//
+// vm_stacks.c - data and return stacks between guard pages.
+//
+// Each stack is its own mapping: a PROT_NONE page, the parking cells and
+// the stack cells filling whole pages, then another PROT_NONE page.  The
+// engines index the stacks without any bounds checks; pushing past the
+// top or popping below the parking cells faults on a guard page instead.
+// `vm_stacks_guard()` runs an engine with a SIGSEGV/SIGBUS handler that
+// turns such a fault into a `VM_STACK_OVERFLOW` or `VM_STACK_UNDERFLOW`
+// return.  The handler is installed once per process, whichever thread
+// runs a context first, and stays installed; any other fault is passed on
+// to the handler that was there before.
+//
+// A trap abandons the engine mid-instruction, so the context keeps the
+// registers it had when the run began while memory and the stacks may
+// already have changed.  Reset it before running it again.
+//
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "vm.h"
+
+struct guard_frame {
+    context*            ctx;
+    sigjmp_buf          env;
+    struct guard_frame* prev;
+};
+
+static __thread struct guard_frame* guard_current;
+static struct sigaction guard_previous[2];
+static pthread_once_t guard_once = PTHREAD_ONCE_INIT;
+
+static size_t stack_page(void) {
+    return sysconf(_SC_PAGESIZE);
+}
+
+// Bytes mapped for a stack of `cells`, guard pages included.
+static size_t stack_mapping(uint32_t cells) {
+    return (cells + VM_STACK_PARK) * sizeof(int64_t) + 2 * stack_page();
+}
+
+// Map a stack of at least `cells` and return its cell 0, or NULL.
+static int64_t* stack_map(uint32_t *cells) {
+    size_t page = stack_page();
+    size_t bytes = ((*cells + VM_STACK_PARK) * sizeof(int64_t) + page - 1) /
+                   page * page;
+    uint8_t *base = mmap(NULL, bytes + 2 * page, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(base + page, bytes, PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, bytes + 2 * page);
+        return NULL;
+    }
+    *cells = bytes / sizeof(int64_t) - VM_STACK_PARK;
+    return (int64_t*)(base + page) + VM_STACK_PARK;
+}
+
+static void stack_unmap(int64_t *stack, uint32_t cells) {
+    if (stack) {
+        munmap((uint8_t*)(stack - VM_STACK_PARK) - stack_page(),
+               stack_mapping(cells));
+    }
+}
+
+// Give `ctx` stacks of at least the given depths, capped at
+// `VM_STACK_MAX_CELLS`, replacing any it had.  The new stacks are empty.
+// Returns false, leaving `ctx` without stacks, if they can't be mapped.
+bool vm_stacks(context *ctx, uint32_t dstack_cells, uint32_t rstack_cells) {
+    vm_stacks_release(ctx);
+    if (dstack_cells > VM_STACK_MAX_CELLS) dstack_cells = VM_STACK_MAX_CELLS;
+    if (rstack_cells > VM_STACK_MAX_CELLS) rstack_cells = VM_STACK_MAX_CELLS;
+    ctx->DSTACK = stack_map(&dstack_cells);
+    ctx->RSTACK = stack_map(&rstack_cells);
+    ctx->DSTACK_DEPTH = dstack_cells;
+    ctx->RSTACK_DEPTH = rstack_cells;
+    if (!ctx->DSTACK || !ctx->RSTACK) {
+        vm_stacks_release(ctx);
+        return false;
+    }
+    ctx->SP = 0;
+    ctx->RSP = 0;
+    return true;
+}
+
+void vm_stacks_release(context *ctx) {
+    stack_unmap(ctx->DSTACK, ctx->DSTACK_DEPTH);
+    stack_unmap(ctx->RSTACK, ctx->RSTACK_DEPTH);
+    ctx->DSTACK = NULL;
+    ctx->RSTACK = NULL;
+    ctx->DSTACK_DEPTH = 0;
+    ctx->RSTACK_DEPTH = 0;
+}
+
+// Which trap, if any, a fault at `addr` is for one of `ctx`'s stacks.
+static int stack_trap(context *ctx, uint8_t *addr) {
+    size_t page = stack_page();
+    int64_t *stacks[2] = { ctx->DSTACK, ctx->RSTACK };
+    uint32_t depths[2] = { ctx->DSTACK_DEPTH, ctx->RSTACK_DEPTH };
+    for (int idx = 0; idx < 2; idx++) {
+        if (!stacks[idx]) continue;
+        uint8_t *bottom = (uint8_t*)(stacks[idx] - VM_STACK_PARK);
+        uint8_t *top = (uint8_t*)(stacks[idx] + depths[idx]);
+        if (addr >= bottom - page && addr < bottom) {
+            return VM_STACK_UNDERFLOW;
+        }
+        if (addr >= top && addr < top + page) {
+            return VM_STACK_OVERFLOW;
+        }
+    }
+    return 0;
+}
+
+static void guard_handler(int sig, siginfo_t *info, void *uc) {
+    struct guard_frame *frame = guard_current;
+    int trap = frame ? stack_trap(frame->ctx, info->si_addr) : 0;
+    if (trap) {
+        siglongjmp(frame->env, trap);
+    }
+    // Not a guard page: chain to the previous handler.  With none, the
+    // fault is fatal, so take the default action by running the faulting
+    // instruction again without a handler.
+    const struct sigaction *previous = &guard_previous[sig == SIGBUS];
+    if (previous->sa_flags & SA_SIGINFO) {
+        previous->sa_sigaction(sig, info, uc);
+    } else if (previous->sa_handler != SIG_DFL &&
+               previous->sa_handler != SIG_IGN) {
+        previous->sa_handler(sig);
+    } else {
+        signal(sig, SIG_DFL);
+    }
+}
+
+static void guard_install(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guard_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &guard_previous[0]);
+    sigaction(SIGBUS, &action, &guard_previous[1]);
+}
+
+// Run `ctx` with `run`, returning its status, or the trap if it faulted
+// on one of `ctx`'s guard pages.  Calls may nest, for a context run from
+// another's io handler.
+int vm_stacks_guard(context *ctx, int (*run)(context *ctx)) {
+    pthread_once(&guard_once, guard_install);
+    struct guard_frame frame = { .ctx = ctx, .prev = guard_current };
+    // The handler runs with SA_NODEFER and an empty mask, so the signal
+    // mask needn't be saved and restored.
+    int trap = sigsetjmp(frame.env, 0);
+    if (trap) {
+        guard_current = frame.prev;
+        return trap;
+    }
+    guard_current = &frame;
+    int status = run(ctx);
+    guard_current = frame.prev;
+    return status;
+}
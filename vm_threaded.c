@@ -0,0 +1,305 @@
+//
+// vm_threaded.c - direct-threaded execution engine using computed goto.
+//
+// Same machine as `vm_switch()` in vm.c, but every decode stage jumps
+// straight to its handler through a label table, and each handler ends with
+// its own copy of the dispatch sequence.  This gives the host branch
+// predictor one indirect jump per handler rather than one shared jump per
+// `switch`.
+//
+
+#include <stdbool.h>
+#include "vm.h"
+#include "vm_instruction.h"
+#include "vm_constants.h"
+#ifdef DEBUG
+#include "vm_debug.h"
+#include "vm_opcodes.h"
+#endif // DEBUG
+
+#if defined(__GNUC__)
+
+#ifdef DEBUG
+#define TRACE() print_state(ctx, RSP, SP, EIP, R, T)
+#else
+#define TRACE()
+#endif // DEBUG
+
+// Fetch the word at `EIP`, stop on a zero word, otherwise advance `EIP` and
+// jump to the handler for its operation class.
+#define DISPATCH() do {                             \
+        raw = ctx->memory[EIP];                     \
+        if (!raw) goto halt;                        \
+        ins = *(instruction*)&(ctx->memory[EIP]);   \
+        TRACE();                                    \
+        EIP++;                                      \
+        cycles++;                                   \
+        goto *op_class[raw >> 13];                  \
+    } while (0)
+
+// A taken branch or call can end a budgeted run.
+#define BUDGET_CHECK() do {                         \
+        if (cycles >= limit) goto preempted;        \
+    } while (0)
+
+int vm_threaded(context *ctx) {
+    register int16_t EIP = ctx->EIP;        // EIP = execution pointer
+    register int16_t SP = ctx->SP;          // SP = data stack pointer
+    register int16_t RSP = ctx->RSP;        // RSP = return stack pointer
+    register int64_t T = ctx->DSTACK[SP-1]; // T = Top Of Stack / TOS
+    register int64_t R = ctx->RSTACK[RSP-1]; // R = Top Of Return Stack / TOR
+    register int64_t IN = 0;                // I = input to ALU
+    register int64_t N;                     // N = Next on Stack / NOS
+    register int64_t OUT = 0;               // OUT - result from ALU
+    register uint64_t cycles = ctx->CYCLES; // how many instructions processed
+    uint64_t limit = ctx->CYCLE_LIMIT;      // stop at a branch past this
+    uint64_t start = cycles;                // the first always runs
+    int status = VM_HALTED;
+    uint16_t raw;
+    instruction ins;
+
+    // The top three bits of a word are `lit_f` and the two `op_type` bits,
+    // or `lit_f`, `lit_add` and the high `lit_shifts` bit for literals.
+    static void* const op_class[8] = {
+            &&op_jmp, &&op_cjmp, &&op_call, &&op_alu,
+            &&op_lit, &&op_lit, &&op_lit_add, &&op_lit_add };
+    static void* const in_mux[4] = {
+            [INPUT_N] = &&in_n,
+            [INPUT_T] = &&in_t,
+            [INPUT_LOAD_T] = &&in_load_t,
+            [INPUT_R] = &&in_r };
+    static void* const alu_op[16] = {
+            [ALU_IN] = &&alu_in,
+            [ALU_SWAP_IN] = &&alu_swap_in,
+            [ALU_T_N] = &&alu_t_n,
+            [ALU_ADD] = &&alu_add,
+            [ALU_AND] = &&alu_and,
+            [ALU_OR] = &&alu_or,
+            [ALU_XOR] = &&alu_xor,
+            [ALU_MUL] = &&alu_mul,
+            [ALU_INVERT] = &&alu_invert,
+            [ALU_EQ] = &&alu_eq,
+            [ALU_GT] = &&alu_gt,
+            [ALU_U_GT] = &&alu_u_gt,
+            [ALU_RSHIFT] = &&alu_rshift,
+            [ALU_LSHIFT] = &&alu_lshift,
+            [ALU_LOAD] = &&alu_load,
+            [ALU_IO_READ] = &&alu_io_read };
+    static void* const out_mux[4] = {
+            [OUTPUT_T] = &&out_t,
+            [OUTPUT_R] = &&out_r,
+            [OUTPUT_IO_T] = &&out_io_t,
+            [OUTPUT_MEM_T] = &&out_mem_t };
+
+    DISPATCH();
+
+    // == Literals
+    op_lit:
+        ctx->DSTACK[SP-1] = T;
+        SP++;
+        T = (int64_t)((uint64_t)ins.lit.lit_v <<
+                      (ins.lit.lit_shifts * LIT_BITS));
+        DISPATCH();
+    op_lit_add:
+        T += (int64_t)((uint64_t)ins.lit.lit_v <<
+                       (ins.lit.lit_shifts * LIT_BITS));
+        DISPATCH();
+
+    // == Jumps and calls
+    op_jmp:
+        EIP = ins.jmp.target;
+        BUDGET_CHECK();
+        DISPATCH();
+    op_cjmp: {
+        SP--;
+        bool RES = (uint64_t)T;
+        T = ctx->DSTACK[SP-1];
+        if (!RES) {
+            EIP = ins.jmp.target;
+            BUDGET_CHECK();
+        }
+        DISPATCH();
+    }
+    op_call:
+        ctx->RSTACK[RSP-1] = R;
+        R = EIP;
+        ctx->RSTACK[RSP] = EIP;
+        RSP++;
+        EIP = ins.jmp.target;
+        BUDGET_CHECK();
+        DISPATCH();
+
+    // == ALU: a return over budget is put back unexecuted, so a preempted
+    // run resumes at the return itself, unless it is the first instruction
+    // of the run, which must make progress.
+    op_alu:
+        if (ins.alu.r_eip && cycles >= limit && cycles > start + 1) {
+            EIP--;
+            cycles--;
+            goto preempted;
+        }
+        N = ctx->DSTACK[SP-2];
+        goto *in_mux[ins.alu.in_mux];
+    in_n:
+        IN = N;
+        goto *alu_op[ins.alu.alu_op];
+    in_t:
+        IN = T;
+        goto *alu_op[ins.alu.alu_op];
+    in_load_t:
+        IN = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+T);
+        goto *alu_op[ins.alu.alu_op];
+    in_r:
+        IN = R;
+        goto *alu_op[ins.alu.alu_op];
+
+    // == ALU: operation
+    alu_in:
+        OUT = IN;
+        goto alu_stacks;
+    alu_swap_in:
+        OUT = ctx->DSTACK[SP - 2];
+        ctx->DSTACK[SP - 2] = T;
+        T = OUT;
+        OUT = IN;
+        goto alu_stacks;
+    alu_t_n:
+        ctx->DSTACK[SP - 2] = T;
+        OUT = IN;
+        goto alu_stacks;
+    alu_add:
+        OUT = IN + N;
+        goto alu_stacks;
+    alu_and:
+        OUT = IN & N;
+        goto alu_stacks;
+    alu_or:
+        OUT = IN | N;
+        goto alu_stacks;
+    alu_xor:
+        OUT = IN ^ N;
+        goto alu_stacks;
+    alu_mul:
+        OUT = IN * N;
+        goto alu_stacks;
+    alu_invert:
+        OUT = ~IN;
+        goto alu_stacks;
+    alu_eq:
+        OUT = IN == N ? TRUE : FALSE;
+        goto alu_stacks;
+    alu_gt:
+        OUT = N < IN ? TRUE : FALSE;
+        goto alu_stacks;
+    alu_u_gt:
+        OUT = (uint64_t) N < (uint64_t) IN ? TRUE : FALSE;
+        goto alu_stacks;
+    alu_rshift:
+        OUT = (uint64_t) IN >> T;
+        goto alu_stacks;
+    alu_lshift:
+        if (INS_EXT(ins)) goto ext;
+        OUT = (uint64_t) IN << T;
+        goto alu_stacks;
+    alu_load:
+        if (INS_NARROW(ins)) goto narrow;
+        OUT = *(uint64_t*)((uint8_t*)(&ctx->memory[0])+IN);
+        goto alu_stacks;
+    alu_io_read:
+        OUT = io_read_handler(ctx, IN);
+        goto alu_stacks;
+
+    // == ALU: R->EIP, stack adjustment, then output select
+    alu_stacks:
+        if (ins.alu.r_eip) EIP = R;
+        SP += ins.alu.dstack;
+        RSP += ins.alu.rstack;
+        if (ins.alu.dstack > 0) {
+            ctx->DSTACK[SP - 2] = T;
+        }
+        if (ins.alu.rstack > 0) {
+            ctx->RSTACK[RSP - 2] = R;
+        }
+        goto *out_mux[ins.alu.out_mux];
+    out_t:
+        T = OUT;
+        if (ins.alu.rstack < 0) {
+            R = ctx->RSTACK[RSP - 1];
+        }
+        DISPATCH();
+    out_r:
+        R = OUT;
+        if (ins.alu.dstack < 0) {
+            T = ctx->DSTACK[SP - 1];
+        }
+        DISPATCH();
+    out_io_t:
+        ctx->SP = SP;
+        ctx->RSP = RSP;
+        ctx->EIP = EIP;
+        io_write_handler(ctx, T, OUT);
+        if (ins.alu.dstack < 0) {
+            T = ctx->DSTACK[SP - 1];
+        }
+        if (ins.alu.rstack < 0) {
+            R = ctx->RSTACK[RSP - 1];
+        }
+        DISPATCH();
+    out_mem_t:
+        *(int64_t*)((uint8_t*)(&ctx->memory[0])+T) = OUT;
+        if (ins.alu.dstack < 0) {
+            T = ctx->DSTACK[SP - 1];
+        }
+        if (ins.alu.rstack < 0) {
+            R = ctx->RSTACK[RSP - 1];
+        }
+        DISPATCH();
+
+    // == `T->IN [IN]` with a width, see `INS_NARROW()`.
+    narrow:
+        SP += ins.alu.dstack;
+        if (ins.alu.dstack > 0) {
+            ctx->DSTACK[SP - 2] = T;
+        }
+        if (ins.alu.out_mux != OUTPUT_MEM_T) {
+            T = vm_load_narrow(ctx, T, INS_WIDTH(ins));
+        } else {
+            vm_store_narrow(ctx, T, N, INS_WIDTH(ins));
+            if (ins.alu.dstack < 0) {
+                T = ctx->DSTACK[SP - 1];
+            }
+        }
+        DISPATCH();
+
+    // == `T->IN IN<<T`, see `INS_EXT()`.
+    ext:
+        ctx->DSTACK[SP - 1] = T;
+        SP = vm_ext(ctx, INS_EXT_OP(ins), SP);
+        T = ctx->DSTACK[SP - 1];
+        DISPATCH();
+
+    preempted:
+        status = VM_PREEMPTED;
+    halt:
+#ifdef DEBUG
+    print_state(ctx, RSP, SP, EIP, R, T);
+#endif
+    ctx->CYCLES = cycles;
+    ctx->DSTACK[SP-1] = T;
+    ctx->RSTACK[RSP-1] = R;
+    ctx->SP = SP;
+    ctx->RSP = RSP;
+    ctx->EIP = EIP;
+    vm_out_flush(ctx);
+    return status;
+}
+
+#else
+
+// Labels-as-values is a GNU extension; without it the threaded engine is
+// the switch engine.
+int vm_threaded(context *ctx) {
+    return vm_switch(ctx);
+}
+
+#endif // __GNUC__
@@ -0,0 +1,78 @@
+//
+// vm_trace_ring.c - opens and closes binary trace rings.
+//
+// See vm_trace_ring.h for the file layout.  The ring is mapped shared, so
+// the file holds every record written so far even if the process dies
+// without closing it.
+//
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "vm.h"
+#include "vm_trace_ring.h"
+
+// Record to a ring of `records` instructions (rounded up to a power of
+// two) in the file at `path`, replacing any ring `ctx` already has.
+// Returns false, leaving `ctx` without a ring, if the file can't be set up.
+bool vm_trace_ring_open(context *ctx, const char *path, uint64_t records) {
+    vm_trace_ring_close(ctx);
+    uint64_t capacity = 1;
+    while (capacity < records) capacity <<= 1;
+    size_t size = sizeof(trace_ring_header) + capacity * sizeof(trace_record);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    FILE *symbols = NULL;
+    if (ftruncate(fd, size) == 0 &&
+        lseek(fd, size, SEEK_SET) == (off_t)size) {
+        symbols = fdopen(fd, "w");
+    }
+    if (!symbols) {
+        close(fd);
+        return false;
+    }
+    for (uint32_t addr = 0; ctx->meta && addr < VM_META_CELLS; addr++) {
+        if (ctx->meta[addr]) {
+            fprintf(symbols, "%04x %s\n", addr, ctx->meta[addr]);
+        }
+    }
+    fflush(symbols);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fileno(symbols), 0);
+    fclose(symbols);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    struct vm_trace_ring *ring = calloc(1, sizeof(struct vm_trace_ring));
+    if (!ring) {
+        munmap(map, size);
+        return false;
+    }
+    ring->header = map;
+    ring->records = (trace_record*)(ring->header + 1);
+    ring->mask = capacity - 1;
+    ring->size = size;
+    memcpy(ring->header->magic, TRACE_RING_MAGIC, sizeof(ring->header->magic));
+    ring->header->capacity = capacity;
+    ring->header->written = 0;
+    ring->header->symbols = size;
+    ctx->ring = ring;
+    return true;
+}
+
+// Stop recording and unmap the ring; the file keeps what was written.
+void vm_trace_ring_close(context *ctx) {
+    struct vm_trace_ring *ring = ctx->ring;
+    if (!ring) return;
+    munmap(ring->header, ring->size);
+    free(ring);
+    ctx->ring = NULL;
+}
@@ -0,0 +1,62 @@
+//
+// vm_trace_ring.h - fixed-size binary trace records in an mmap'd file.
+//
+// A trace ring file is a header, `capacity` records and a symbol list, in
+// that order.  The traced switch loop writes one record per instruction
+// into the ring, overwriting the oldest once it is full, so a long run
+// keeps its last `capacity` instructions at the cost of a few stores each.
+// The symbol list holds `ctx->meta` as "addr name" lines, written when the
+// ring is opened; hexaforth-trace renders a ring file as text.
+//
+
+#ifndef HEXAFORTH_VM_TRACE_RING_H
+#define HEXAFORTH_VM_TRACE_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_RING_MAGIC "HXTRACE1"
+
+typedef struct {
+    char       magic[8];
+    uint64_t   capacity;        // records in the ring, a power of two
+    uint64_t   written;         // records ever written
+    uint64_t   symbols;         // file offset of the symbol list
+    uint8_t    reserved[32];
+} trace_ring_header;
+
+typedef struct {
+    uint64_t   cycle;           // instructions executed before this one
+    int64_t    T;
+    int64_t    R;
+    uint16_t   EIP;
+    uint16_t   raw;             // the instruction at EIP
+    int16_t    SP;
+    int16_t    RSP;
+} trace_record;
+
+struct vm_trace_ring {
+    trace_ring_header* header;
+    trace_record*      records;
+    uint64_t           mask;
+    size_t             size;    // bytes mapped
+};
+
+// The record for the oldest instruction still in the ring is at
+// `written & mask` once it has wrapped, and at 0 before.
+static inline void vm_trace_ring_record(struct vm_trace_ring *ring,
+                                        uint64_t cycle, uint16_t EIP,
+                                        uint16_t raw, int16_t SP,
+                                        int16_t RSP, int64_t T, int64_t R) {
+    trace_record *record =
+            &ring->records[ring->header->written++ & ring->mask];
+    record->cycle = cycle;
+    record->T = T;
+    record->R = R;
+    record->EIP = EIP;
+    record->raw = raw;
+    record->SP = SP;
+    record->RSP = RSP;
+}
+
+#endif //HEXAFORTH_VM_TRACE_RING_H